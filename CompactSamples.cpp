@@ -0,0 +1,207 @@
+/* CompactSamples Classes
+ * compact storage of SimTool particle data (trajectory, gamma) during spin tracking.
+ * The data is sampled once at all lattice elements for the tracked turns and stored
+ * with the smallest type (16bit integer, float, double) meeting a given precision.
+ * Sequential access (element by element) is fast due to a cursor.
+ *
+ * Copyright (C) 2017 Jan Felix Schmidt <janschmidt@mailbox.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+#include <sstream>
+#include "CompactSamples.hpp"
+
+
+void ElementSampling::init(const pal::AccLattice &lattice, unsigned int first, unsigned int last)
+{
+  elementPos.clear();
+  elementPos.reserve(lattice.size());
+  for (auto it=lattice.begin(); it!=lattice.end(); ++it)
+    elementPos.push_back(it.pos());
+  if (elementPos.empty())
+    throw std::runtime_error("ElementSampling: empty lattice");
+  circumference = lattice.circumference();
+  firstTurn = (first==0) ? 1 : first;
+  lastTurn = last;
+  cursor = 0;
+}
+
+
+double ElementSampling::pos(std::size_t i) const
+{
+  std::size_t n = elementPos.size();
+  return (firstTurn - 1 + i/n) * circumference + elementPos[i%n];
+}
+
+
+double ElementSampling::pos(long turn, unsigned int element) const
+{
+  return (turn-1) * circumference + elementPos[element];
+}
+
+
+double ElementSampling::distanceNext(unsigned int element) const
+{
+  if (element+1 < elementPos.size())
+    return elementPos[element+1] - elementPos[element];
+  return circumference + elementPos[0] - elementPos[element];
+}
+
+
+unsigned int ElementSampling::element(double pos, long &turn, double &distance, double tolerance) const
+{
+  unsigned int n = elementPos.size();
+  double turnPos = std::floor(pos/circumference);
+  turn = long(turnPos) + 1;
+  double s = pos - turnPos*circumference;
+
+  // in front of first element: belongs to last element of previous turn
+  unsigned int e;
+  if (s < elementPos[0]) {
+    s += circumference;
+    turn--;
+    e = n-1;
+  }
+  else {
+    // sequential access hits current or next element, otherwise search
+    auto contains = [&](unsigned int i) {return elementPos[i] <= s && (i+1==n || s < elementPos[i+1]);};
+    if (contains(cursor))
+      e = cursor;
+    else if (cursor+1 < n && contains(cursor+1))
+      e = cursor+1;
+    else
+      e = std::upper_bound(elementPos.begin(), elementPos.end(), s) - elementPos.begin() - 1;
+  }
+  distance = s - elementPos[e];
+
+  // pos slightly in front of next element (e.g. rounding of summed up positions)
+  if (tolerance > 0. && distanceNext(e) - distance < tolerance) {
+    distance -= distanceNext(e);
+    if (++e == n) {
+      e = 0;
+      turn++;
+    }
+    while (e+1 < n && distanceNext(e) == 0.) // same position: last element (as without tolerance)
+      e++;
+  }
+  cursor = e;
+  return e;
+}
+
+
+std::size_t ElementSampling::locate(double pos, double &weight) const
+{
+  const double tolerance = 1e-6; // m, rounding of summed up positions at both ends of the range
+  long turn;
+  double distance;
+  unsigned int e = element(pos, turn, distance);
+
+  weight = 0.;
+  if (turn < long(firstTurn)) {
+    if (turn+1 == long(firstTurn) && size() > 0 && distanceNext(e) - distance < tolerance)
+      return 0;
+  }
+  else {
+    std::size_t i = (turn-firstTurn)*elementPos.size() + e;
+    if (i+1 < size()) {
+      weight = distance / distanceNext(e);
+      return i;
+    }
+    if (i+1 == size() && distance < tolerance)
+      return i;
+  }
+
+  std::stringstream msg;
+  msg << "ElementSampling: position " << pos << " m outside of sampled range";
+  if (size() > 0)
+    msg << " [" << this->pos(0) << " m, " << this->pos(size()-1) << " m] (turns " << firstTurn << "-" << lastTurn << ")";
+  throw std::runtime_error(msg.str());
+}
+
+
+
+void CompactSamples::init(std::size_t n, double min, double max, double precision)
+{
+  clear();
+  offset = 0.5*(max+min);
+  double range = 0.5*(max-min); // max. |value-offset|
+  scale = (range > 0.) ? range/32767. : 1.;
+
+  if (scale/2. <= precision) {
+    encoding = Encoding::int16;
+    i16.resize(n);
+  }
+  else if (range*std::numeric_limits<float>::epsilon()/2. <= precision) {
+    encoding = Encoding::float32;
+    f32.resize(n);
+  }
+  else {
+    encoding = Encoding::float64;
+    f64.resize(n);
+  }
+}
+
+
+void CompactSamples::set(std::size_t i, double value)
+{
+  switch (encoding) {
+  case Encoding::int16:
+    i16[i] = std::int16_t( std::lround((value-offset)/scale) );
+    break;
+  case Encoding::float32:
+    f32[i] = float(value-offset);
+    break;
+  default:
+    f64[i] = value;
+  }
+}
+
+
+void CompactSamples::clear()
+{
+  // swap frees memory (clear() does not)
+  std::vector<std::int16_t>().swap(i16);
+  std::vector<float>().swap(f32);
+  std::vector<double>().swap(f64);
+}
+
+
+std::size_t CompactSamples::size() const
+{
+  return i16.size() + f32.size() + f64.size();
+}
+
+
+std::size_t CompactSamples::bytes() const
+{
+  return i16.size()*sizeof(std::int16_t) + f32.size()*sizeof(float) + f64.size()*sizeof(double);
+}
+
+
+std::string CompactSamples::encodingString() const
+{
+  switch (encoding) {
+  case Encoding::int16:
+    return "int16";
+  case Encoding::float32:
+    return "float";
+  default:
+    return "double";
+  }
+}
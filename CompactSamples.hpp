@@ -0,0 +1,108 @@
+/* CompactSamples Classes
+ * compact storage of SimTool particle data (trajectory, gamma) during spin tracking.
+ * The data is sampled once at all lattice elements for the tracked turns and stored
+ * with the smallest type (16bit integer, float, double) meeting a given precision.
+ * Sequential access (element by element) is fast due to a cursor.
+ *
+ * Copyright (C) 2017 Jan Felix Schmidt <janschmidt@mailbox.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __POLEMATRIX__COMPACTSAMPLES_HPP_
+#define __POLEMATRIX__COMPACTSAMPLES_HPP_
+
+#include <vector>
+#include <cstdint>
+#include <string>
+#include <libpalattice/AccLattice.hpp>
+
+
+// sample positions: all lattice elements in turns firstTurn to lastTurn (palattice turns start at 1)
+class ElementSampling
+{
+protected:
+  std::vector<double> elementPos;   // position of each element in its turn
+  double circumference;
+  unsigned int firstTurn;
+  unsigned int lastTurn;
+  mutable unsigned int cursor;      // result of last element() call
+
+public:
+  ElementSampling() : circumference(0.), firstTurn(1), lastTurn(0), cursor(0) {}
+
+  void init(const pal::AccLattice &lattice, unsigned int first, unsigned int last);
+  std::size_t size() const {return (lastTurn < firstTurn) ? 0 : elementPos.size() * (lastTurn-firstTurn+1);}
+  double pos(std::size_t i) const;  // position of sample i
+  double pos(long turn, unsigned int element) const;
+  double distanceNext(unsigned int element) const;
+
+  // element at or in front of pos, its turn and distance of pos from element.
+  // an element closer than tolerance behind pos is returned with negative distance
+  unsigned int element(double pos, long &turn, double &distance, double tolerance=0.) const;
+
+  // index of sample at or in front of pos and weight of next sample for linear interpolation
+  std::size_t locate(double pos, double &weight) const;
+};
+
+
+
+// values stored as offset + scale*int16, offset + float or double
+class CompactSamples
+{
+public:
+  enum class Encoding {int16, float32, float64};
+
+protected:
+  Encoding encoding;
+  double offset;
+  double scale;
+  std::vector<std::int16_t> i16;
+  std::vector<float> f32;
+  std::vector<double> f64;
+
+public:
+  CompactSamples() : encoding(Encoding::float64), offset(0.), scale(1.) {}
+
+  // allocate n samples with values in [min,max]. max. absolute error of stored values is precision
+  void init(std::size_t n, double min, double max, double precision);
+  void set(std::size_t i, double value);
+  void clear();
+
+  std::size_t size() const;
+  bool empty() const {return size()==0;}
+  std::size_t bytes() const;
+  std::string encodingString() const;
+
+  double operator[](std::size_t i) const {
+    switch (encoding) {
+    case Encoding::int16:
+      return offset + scale*i16[i];
+    case Encoding::float32:
+      return offset + f32[i];
+    default:
+      return f64[i];
+    }
+  }
+  double interp(std::size_t i, double weight) const {
+    if (weight == 0.)
+      return (*this)[i];
+    double v = (*this)[i];
+    return v + weight * ((*this)[i+1] - v);
+  }
+};
+
+
+#endif
+// __POLEMATRIX__COMPACTSAMPLES_HPP_
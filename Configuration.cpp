@@ -33,6 +33,10 @@ Configuration::Configuration(std::string pathIn)
   _savePhaseSpace.assign(1, false);
   _simToolRamp = true;
   _simToolRampSteps = 200;
+  _simToolCache = "";
+  _simToolChunks = 1;
+  _compactTrajectory = 0.;
+  _compactGamma = 0.;
 
   _t_start = _t_stop = 0.;
   _dt_out = 1e-4;
@@ -44,6 +48,19 @@ Configuration::Configuration(std::string pathIn)
   _gammaMode = GammaMode::radiation;
   _trajectoryMode = TrajectoryMode::closed_orbit;
   _edgefoc = false;
+  _linearFields = false;
+  _linearFieldsCheck = false;
+  _trackResStrengths = false;
+  _transferMatrix = false;
+  _histogramBins = 0;
+  _spinFiles = true;
+  _adaptiveOutput = false;
+  _adaptiveOutputWindow = 0.05;
+  _adaptiveOutputDt = _dt_out/10.;
+  _spectrum = false;
+  _spectrumWindow = 256;
+  _spectrumSampling = 1;
+  _spectrumBins = 256;
   _outElementUsed = false;
   
   _seed = randomSeed();
@@ -56,10 +73,21 @@ Configuration::Configuration(std::string pathIn)
   _sigmaPhaseFactor = 1.;
   _sigmaGammaFactor = 1.;
   _checkStability = true;
+  _sampling = Sampling::random;
+  _antithetic = false;
+  _convergence = false;
+  _convergenceTolerance = 0.01;
+  _convergenceMinParticles = 10;
   _agammaMin = 0.;
   _agammaMax = 10.;
   _nTurns = 0;
   _dagamma = 1.;
+  _nufft = false;
+  _nufftTolerance = 1e-10;
+  _adaptive = false;
+  _adaptiveTolerance = 0.01;
+  _adaptiveMinStep = 0.001;
+  _resStrengthsCache = "";
 
   palattice.reset(new pal::SimToolInstance(pal::elegant, pal::online, ""));
 
@@ -89,6 +117,15 @@ std::string Configuration::trajectoryModeString() const
     return "Please implement this TrajectoryModel in Configuration::trajectoryModeString()!";
 }
 
+std::string Configuration::samplingString() const
+{
+  if (_sampling==Sampling::random) return "random";
+  else if (_sampling==Sampling::halton) return "halton";
+  else if (_sampling==Sampling::sobol) return "sobol";
+  else
+    return "Please implement this Sampling in Configuration::samplingString()!";
+}
+
 double Configuration::gamma(double t) const
 {
   double E = (E0() + dE() * t);
@@ -119,8 +156,14 @@ void Configuration::save(const std::string &filename) const
   tree.put("spintracking.s_start.s", _s_start[1]);
   tree.put("spintracking.edgeFocussing", _edgefoc);
   tree.put("palattice.simTool", palattice->tool_string());
-  tree.put("palattice.mode", palattice->mode_string());
-  tree.put("palattice.file", palattice->inFile());
+  if (_simToolConfigured.first.empty()) {
+    tree.put("palattice.mode", palattice->mode_string());
+    tree.put("palattice.file", palattice->inFile());
+  }
+  else { // SimTool output imported from cache: save original configuration
+    tree.put("palattice.mode", _simToolConfigured.first);
+    tree.put("palattice.file", _simToolConfigured.second);
+  }
   tree.put("palattice.saveGamma", saveGammaList());
   tree.put("palattice.simToolRamp.set", simToolRamp());
   tree.put("palattice.simToolRamp.steps", simToolRampSteps());
@@ -134,6 +177,15 @@ void Configuration::save(const std::string &filename) const
   tree.put("resonancestrengths.spintune.max", agammaMax());
   tree.put("resonancestrengths.spintune.step", _dagamma);
   tree.put("resonancestrengths.turns", _nTurns);
+  tree.put("resonancestrengths.nufft.set", nufft());
+  tree.put("resonancestrengths.nufft.tolerance", nufftTolerance());
+  if (adaptive()) {
+    tree.put("resonancestrengths.adaptive.set", adaptive());
+    tree.put("resonancestrengths.adaptive.tolerance", adaptiveTolerance());
+    tree.put("resonancestrengths.adaptive.minStep", adaptiveMinStep());
+  }
+  if (!resStrengthsCache().empty())
+    tree.put("resonancestrengths.cache", resStrengthsCache().string());
   tree.put("oscillation.emittance.x", emittance().x);
   tree.put("oscillation.emittance.z", emittance().z);
 
@@ -148,6 +200,44 @@ void Configuration::save(const std::string &filename) const
   if (outElementUsed()) {
     tree.put("spintracking.outElement", outElement());
   }
+  if (linearFields()) {
+    tree.put("spintracking.linearFields.set", linearFields());
+    tree.put("spintracking.linearFields.check", linearFieldsCheck());
+  }
+  if (trackResStrengths()) {
+    tree.put("spintracking.resonanceStrengths", trackResStrengths());
+  }
+  if (transferMatrix()) {
+    tree.put("spintracking.transferMatrix", transferMatrix());
+  }
+  if (histogramBins() > 0) {
+    tree.put("spintracking.histogramBins", histogramBins());
+  }
+  if (!spinFiles()) {
+    tree.put("spintracking.spinFiles", spinFiles());
+  }
+  if (adaptiveOutput()) {
+    tree.put("spintracking.adaptiveOutput.set", adaptiveOutput());
+    tree.put("spintracking.adaptiveOutput.window", adaptiveOutputWindow());
+    tree.put("spintracking.adaptiveOutput.dt_out", adaptiveOutputDt());
+  }
+  if (spectrum()) {
+    tree.put("spintracking.spectrum.set", spectrum());
+    tree.put("spintracking.spectrum.window", spectrumWindow());
+    tree.put("spintracking.spectrum.sampling", spectrumSampling());
+    tree.put("spintracking.spectrum.bins", spectrumBins());
+  }
+  if (sampling() != Sampling::random) {
+    tree.put("spintracking.startDistribution.sampling", samplingString());
+  }
+  if (antithetic()) {
+    tree.put("spintracking.startDistribution.antithetic", antithetic());
+  }
+  if (convergence()) {
+    tree.put("spintracking.convergence.set", convergence());
+    tree.put("spintracking.convergence.tolerance", convergenceTolerance());
+    tree.put("spintracking.convergence.minParticles", convergenceMinParticles());
+  }
   if (tune().x != 0. || tune().z != 0.) {
     tree.put("oscillation.tune.x", tune().x);
     tree.put("oscillation.tune.z", tune().z);
@@ -166,6 +256,18 @@ void Configuration::save(const std::string &filename) const
   if (Js() != 0.) {
     tree.put("radiation.longitudinal_damping_partition_number", Js());
   }
+  if (!simToolCache().empty()) {
+    tree.put("palattice.cache", simToolCache().string());
+  }
+  if (simToolChunks() > 1) {
+    tree.put("palattice.chunks", simToolChunks());
+  }
+  if (compactTrajectory() > 0.) {
+    tree.put("palattice.compact.trajectory", compactTrajectory());
+  }
+  if (compactGamma() > 0.) {
+    tree.put("palattice.compact.gamma", compactGamma());
+  }
 
 
   #if BOOST_VERSION < 105600
@@ -211,6 +313,7 @@ void Configuration::load(const std::string &filename)
     //optional, but throws if invalid value
     setGammaMode(tree);
     setTrajectoryMode(tree);
+    setSampling(tree);
   }
   catch (pt::ptree_error &e) {
     std::cout << "Error loading configuration file:" << std::endl
@@ -247,9 +350,33 @@ void Configuration::load(const std::string &filename)
   set_dt_out( tree.get("spintracking.dt_out", duration()/default_steps) );
   set_Emax( tree.get("spintracking.Emax", 1e10) );
   set_edgefoc( tree.get<bool>("spintracking.edgeFocussing", false) );
+  set_linearFields( tree.get<bool>("spintracking.linearFields.set", false) );
+  set_linearFieldsCheck( tree.get<bool>("spintracking.linearFields.check", false) );
+  set_trackResStrengths( tree.get<bool>("spintracking.resonanceStrengths", false) );
+  set_transferMatrix( tree.get<bool>("spintracking.transferMatrix", false) );
+  set_histogramBins( tree.get<unsigned int>("spintracking.histogramBins", 0) );
+  set_spinFiles( tree.get<bool>("spintracking.spinFiles", true) );
+  set_adaptiveOutput( tree.get<bool>("spintracking.adaptiveOutput.set", false) );
+  set_adaptiveOutputWindow( tree.get<double>("spintracking.adaptiveOutput.window", 0.05) );
+  set_adaptiveOutputDt( tree.get<double>("spintracking.adaptiveOutput.dt_out", dt_out()/10.) );
+  set_spectrum( tree.get<bool>("spintracking.spectrum.set", false) );
+  set_spectrumWindow( tree.get<unsigned int>("spintracking.spectrum.window", 256) );
+  set_spectrumSampling( tree.get<unsigned int>("spintracking.spectrum.sampling", 1) );
+  set_spectrumBins( tree.get<unsigned int>("spintracking.spectrum.bins", 256) );
   set_saveGamma( tree.get<std::string>("palattice.saveGamma", "") );
   set_simToolRamp( tree.get<bool>("palattice.simToolRamp.set", true) );
   set_simToolRampSteps( tree.get<unsigned int>("palattice.simToolRamp.steps", 200) );
+  set_simToolCache( tree.get<std::string>("palattice.cache", "") );
+  set_simToolChunks( tree.get<unsigned int>("palattice.chunks", 1) );
+  if (simToolChunks() > 1 && (palattice->tool != pal::elegant || palattice->mode != pal::online)) {
+    std::cout << "WARNING: Splitting SimTool tracking is implemented for elegant in online mode only." << std::endl
+	      << "         Option <chunks> is ignored." << std::endl;
+    set_simToolChunks(1);
+  }
+  if (simToolChunks() > nParticles())
+    set_simToolChunks(nParticles());
+  set_compactTrajectory( tree.get("palattice.compact.trajectory", 0.0) );
+  set_compactGamma( tree.get("palattice.compact.gamma", 0.0) );
   set_seed( tree.get<int>("radiation.seed", randomSeed()) );
   set_alphac( tree.get("radiation.momentum_compaction_factor", 0.0) );
   set_alphac2( tree.get("radiation.momentum_compaction_factor_2", 0.0) );
@@ -262,12 +389,22 @@ void Configuration::load(const std::string &filename)
   set_sigmaPhaseFactor( tree.get<double>("radiation.startDistribution.sigmaPhaseFactor", 1.0) );
   set_sigmaGammaFactor( tree.get<double>("radiation.startDistribution.sigmaGammaFactor", 1.0) );
   set_checkStability( tree.get<bool>("radiation.checkStability", true) );
+  set_antithetic( tree.get<bool>("spintracking.startDistribution.antithetic", false) );
+  set_convergence( tree.get<bool>("spintracking.convergence.set", false) );
+  set_convergenceTolerance( tree.get<double>("spintracking.convergence.tolerance", 0.01) );
+  set_convergenceMinParticles( tree.get<unsigned int>("spintracking.convergence.minParticles", 10) );
   set_tune_x( tree.get<double>("oscillation.tune.x", 0.0) );
   set_tune_z( tree.get<double>("oscillation.tune.z", 0.0) );
   set_agammaMin( tree.get<double>("resonancestrengths.spintune.min", 0.) );
   set_agammaMax( tree.get<double>("resonancestrengths.spintune.max", 10.) );
   set_dagamma( tree.get<double>("resonancestrengths.spintune.step", 1.) );
   set_nTurns( tree.get<unsigned int>("resonancestrengths.turns", 0) );
+  set_nufft( tree.get<bool>("resonancestrengths.nufft.set", false) );
+  set_nufftTolerance( tree.get<double>("resonancestrengths.nufft.tolerance", 1e-10) );
+  set_adaptive( tree.get<bool>("resonancestrengths.adaptive.set", false) );
+  set_adaptiveTolerance( tree.get<double>("resonancestrengths.adaptive.tolerance", 0.01) );
+  set_adaptiveMinStep( tree.get<double>("resonancestrengths.adaptive.minStep", 0.001) );
+  set_resStrengthsCache( tree.get<std::string>("resonancestrengths.cache", "") );
   rf.set(tree);
 
   try {
@@ -332,7 +469,35 @@ void Configuration::printSummary() const
   s << "transversal phase space model (TrajectoryModel): \"" << trajectoryModeString() << "\"" << std::endl;
   if (edgefoc())
     s << "horizontal dipole edge focussing field used" << std::endl;
-  s << "output for each spin vector to " << spinDirectory().string() <<"/"<< std::endl;
+  if (linearFields() && trajectoryMode() != TrajectoryMode::closed_orbit) {
+    s << "linearized element fields used";
+    if (linearFieldsCheck())
+      s << " (compared to full field calculation)";
+    s << std::endl;
+  }
+  if (sampling() != Sampling::random || antithetic()) {
+    s << "start distribution: " << samplingString() << " sampling";
+    if (antithetic())
+      s << ", antithetic pairs";
+    s << std::endl;
+  }
+  if (convergence())
+    s << "particles tracked until standard error of polarization < " << convergenceTolerance()
+      << " (max. " << nParticles() << ")" << std::endl;
+  if (transferMatrix())
+    s << "spin transfer matrix tracked (polarization for start spins x, s, z)" << std::endl;
+  if (trackResStrengths())
+    s << "resonance strengths from tracked fields for spin tune " << agammaMin() << " to " << agammaMax() << std::endl;
+  if (spinFiles())
+    s << "output for each spin vector to " << spinDirectory().string() <<"/"<< std::endl;
+  if (histogramBins() > 0)
+    s << "histograms of spin distribution with " << histogramBins() << " bins" << std::endl;
+  if (adaptiveOutput())
+    s << "output step " << adaptiveOutputDt() << " s within spin tune +-" << adaptiveOutputWindow()
+      << " of resonances" << std::endl;
+  if (spectrum())
+    s << "spin precession spectrum (" << spectrumBins() << " bins) per " << spectrumWindow()
+      << " samples, one sample every " << spectrumSampling() << " turns" << std::endl;
   if (outElementUsed())
     s << "output at lattice element " << outElement() << " only "<< std::endl;
   s << "-----------------------------------------------------------------" << std::endl;
@@ -380,6 +545,14 @@ void Configuration::setSimToolInstance(pt::ptree &tree)
   palattice.reset(new pal::SimToolInstance(tool, mode, file));
 }
 
+void Configuration::set_simToolOffline(const std::string &file)
+{
+  if (_simToolConfigured.first.empty())
+    _simToolConfigured = std::make_pair(palattice->mode_string(), palattice->inFile());
+  palattice.reset(new pal::SimToolInstance(palattice->tool, pal::offline, file));
+  info.add("simtool output imported from", file);
+}
+
 void Configuration::setGammaMode(pt::ptree &tree)
 {
   std::string s;
@@ -433,6 +606,19 @@ void Configuration::setTrajectoryMode(pt::ptree &tree)
     throw pt::ptree_error("Invalid trajectoryModel "+s);
 }
 
+void Configuration::setSampling(pt::ptree &tree)
+{
+  std::string s = tree.get<std::string>("spintracking.startDistribution.sampling", "random");
+  if (s == "random")
+    _sampling = Sampling::random;
+  else if (s == "halton")
+    _sampling = Sampling::halton;
+  else if (s == "sobol")
+    _sampling = Sampling::sobol;
+  else
+    throw pt::ptree_error("Invalid startDistribution sampling "+s);
+}
+
 
 // parse particleIds from comma separated string
 // also ranges (e.g. 0-99) can be parsed
@@ -557,16 +743,27 @@ void Configuration::updateSimToolSettings(const pal::AccLattice& lattice)
   //set energy to E0
   double p_MeV = E0()*1000.;
   palattice->setMomentum_MeV(p_MeV);
-  
+
+  // tracking in separate SimToolInstances (see SimToolStore)
+  if (simToolChunks() > 1 && simToolTracking()) {
+    std::cout << "* " << palattice->tool_string() << " tracking is split into " << simToolChunks()
+	      << " runs" << std::endl;
+    return;
+  }
+
+  setSimToolTracking(*palattice, lattice);
+}
+
+
+// write number of turns & energy ramp for particle tracking to given SimToolInstance
+void Configuration::setSimToolTracking(pal::SimToolInstance& sim, const pal::AccLattice& lattice) const
+{
   //set number of turns based on tracking time & circumference
-  if (gammaMode() == GammaMode::simtool
-      || gammaMode()==GammaMode::simtool_plus_linear
-      || gammaMode()==GammaMode::simtool_no_interpolation
-      || trajectoryMode() == TrajectoryMode::simtool) {
+  if (simToolTracking()) {
     unsigned int turns = (duration()*GSL_CONST_MKSA_SPEED_OF_LIGHT / lattice.circumference()) + 1;
-    palattice->verbose = true;
-    palattice->setTurns(turns);
-    std::cout << "* " << palattice->tool_string() <<" tracking " << turns <<" turns to get single particle trajectories" << std::endl;
+    sim.verbose = true;
+    sim.setTurns(turns);
+    std::cout << "* " << sim.tool_string() <<" tracking " << turns <<" turns to get single particle trajectories" << std::endl;
   }
 
   //set energy ramp
@@ -574,30 +771,95 @@ void Configuration::updateSimToolSettings(const pal::AccLattice& lattice)
       || gammaMode() == GammaMode::simtool_no_interpolation
       || trajectoryMode() == TrajectoryMode::simtool) {
     if (simToolRamp()) {
-      if (palattice->tool==pal::SimTool::elegant) {
-	palattice->elegantEnergyRamp.tStart = t_start();
-	palattice->elegantEnergyRamp.tStop = t_stop();
-	palattice->elegantEnergyRamp.nSteps = simToolRampSteps();
-	palattice->elegantEnergyRamp.set([&](double t) {return gamma(t)*E_rest_GeV/E0();} );
-	std::cout << "* " << palattice->tool_string() << " energy ramp set" << std::endl;
+      if (sim.tool==pal::SimTool::elegant) {
+	sim.elegantEnergyRamp.tStart = t_start();
+	sim.elegantEnergyRamp.tStop = t_stop();
+	sim.elegantEnergyRamp.nSteps = simToolRampSteps();
+	sim.elegantEnergyRamp.set([&](double t) {return gamma(t)*E_rest_GeV/E0();} );
+	std::cout << "* " << sim.tool_string() << " energy ramp set" << std::endl;
       }
       else
-	std::cout << "WARNING: Setting SimTool energy ramp is not implemented for " << palattice->tool_string() << std::endl
+	std::cout << "WARNING: Setting SimTool energy ramp is not implemented for " << sim.tool_string() << std::endl
 		  << "         Option <simToolRamp> is ignored." << std::endl;
     }
   }
 }
 
-// #turns for resonance strengths calc are calculated from stepwidth dagamma() if not set
+// #turns for resonance strengths calc are calculated from stepwidth dagamma() if not set.
+// with adaptive grid the finest step width adaptiveMinStep() is used
 unsigned int Configuration::numTurns() const
 {
   if (_nTurns != 0)
     return _nTurns;
   else {
-    return (unsigned int) (1./std::fabs(dagamma()) + 0.5);
+    double step = adaptive() ? std::min(std::fabs(dagamma()), adaptiveMinStep()) : std::fabs(dagamma());
+    return (unsigned int) (1./step + 0.5);
   }
 }
 
+void Configuration::set_nufftTolerance(double t)
+{
+  if (t <= 0. || t >= 1.)
+    throw pt::ptree_error("Invalid resonancestrengths.nufft.tolerance (must be between 0 and 1)");
+  _nufftTolerance = t;
+}
+
+void Configuration::set_adaptiveTolerance(double t)
+{
+  if (t <= 0.)
+    throw pt::ptree_error("Invalid resonancestrengths.adaptive.tolerance (must be > 0)");
+  _adaptiveTolerance = t;
+}
+
+void Configuration::set_convergenceTolerance(double t)
+{
+  if (t <= 0.)
+    throw pt::ptree_error("Invalid spintracking.convergence.tolerance (must be > 0)");
+  _convergenceTolerance = t;
+}
+
+void Configuration::set_adaptiveOutputWindow(double w)
+{
+  if (w <= 0.)
+    throw pt::ptree_error("Invalid spintracking.adaptiveOutput.window (must be > 0)");
+  _adaptiveOutputWindow = w;
+}
+
+void Configuration::set_adaptiveOutputDt(double dt)
+{
+  if (dt <= 0.)
+    throw pt::ptree_error("Invalid spintracking.adaptiveOutput.dt_out (must be > 0)");
+  _adaptiveOutputDt = dt;
+}
+
+void Configuration::set_spectrumWindow(unsigned int n)
+{
+  if (n < 2)
+    throw pt::ptree_error("Invalid spintracking.spectrum.window (must be >= 2)");
+  _spectrumWindow = n;
+}
+
+void Configuration::set_spectrumSampling(unsigned int n)
+{
+  if (n == 0)
+    throw pt::ptree_error("Invalid spintracking.spectrum.sampling (must be > 0)");
+  _spectrumSampling = n;
+}
+
+void Configuration::set_spectrumBins(unsigned int n)
+{
+  if (n == 0)
+    throw pt::ptree_error("Invalid spintracking.spectrum.bins (must be > 0)");
+  _spectrumBins = n;
+}
+
+void Configuration::set_adaptiveMinStep(double s)
+{
+  if (s <= 0.)
+    throw pt::ptree_error("Invalid resonancestrengths.adaptive.minStep (must be > 0)");
+  _adaptiveMinStep = s;
+}
+
 
 
 
@@ -622,15 +884,27 @@ void RfMagnetConfig::set(const pt::ptree &tree)
 }
 
 
-void RfMagnetConfig::writeToLattice(pal::AccLattice& lattice) const
+std::vector<unsigned int> RfMagnetConfig::writeToLattice(pal::AccLattice& lattice) const
 {
+  std::vector<unsigned int> indices;
+  const pal::AccLattice& l = lattice;
   for (auto i=0u; i<elements.size(); i++) {
     lattice[elements[i]].element()->Qrf1 = Q1[i];
     lattice[elements[i]].element()->dQrf = dQ[i];
     lattice[elements[i]].element()->rfPeriod = period[i];
     std::cout << "* set up " << elements[i] << " as RF magnet (Q1=" << Q1[i]
 	      << ", dQ=" << dQ[i] << ", period=" << period[i] << ")" << std::endl;
+
+    auto rfElement = l[elements[i]];
+    unsigned int index = 0;
+    for (auto it=l.begin(); it!=l.end(); ++it, index++) {
+      if (it == rfElement) {
+	indices.push_back(index);
+	break;
+      }
+    }
   }
+  return indices;
 }
 
 
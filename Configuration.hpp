@@ -21,6 +21,7 @@
 #define __POLEMATRIX__CONFIGURATION_HPP_
 
 #include <string>
+#include <cmath>
 #include <armadillo>
 #include <gsl/gsl_const_mksa.h>
 #include <fstream>
@@ -40,6 +41,7 @@ namespace fs = boost::filesystem;
 
 enum class GammaMode{linear, offset, oscillation, radiation, simtool, simtool_plus_linear, simtool_no_interpolation};
 enum class TrajectoryMode{closed_orbit, simtool, oscillation};
+enum class Sampling{random, halton, sobol};
 
 
 
@@ -61,7 +63,7 @@ public:
   ~RfMagnetConfig() {};
 
   void set(const pt::ptree &tree);
-  void writeToLattice(pal::AccLattice& lattice) const;
+  std::vector<unsigned int> writeToLattice(pal::AccLattice& lattice) const; // returns lattice indices of rf magnets
   void writeToConfig(pt::ptree &tree) const;
 
   // comma separated string getters to write config
@@ -86,12 +88,18 @@ private:
   double _circumference;
   bool _simToolRamp;
   unsigned int _simToolRampSteps;
+  fs::path _simToolCache;   // directory for cached SimTool output (see SimToolCache), empty: no cache
+  unsigned int _simToolChunks; // number of parallel SimTool runs for particle tracking (see SimToolStore)
+  double _compactTrajectory;    // precision (m) of compact trajectory storage (see CompactSamples), 0: not used
+  double _compactGamma;         // precision of compact gamma storage, 0: not used
+  std::pair<std::string,std::string> _simToolConfigured; // mode & file from config file, if replaced by set_simToolOffline()
 
   pal::SimTool toolFromTree(pt::ptree tree, std::string key) const;
   pal::SimToolMode modeFromTree(pt::ptree tree, std::string key) const;
   void setSimToolInstance(pt::ptree &tree);
   void setGammaMode(pt::ptree &tree);
   void setTrajectoryMode(pt::ptree &tree);
+  void setSampling(pt::ptree &tree);
 
   //not in config file (cmdline options)
   fs::path _outpath;
@@ -109,6 +117,19 @@ private:
   GammaMode _gammaMode;
   TrajectoryMode _trajectoryMode;
   bool _edgefoc;            // edge focussing field (Bx) of Dipoles included ?
+  bool _linearFields;       // linearized element fields B_int(x,z) used (see ElementFields) ?
+  bool _linearFieldsCheck;  // compare linearized fields to full B_int evaluation
+  bool _trackResStrengths;  // res. strengths from tracked fields (grid from resonancestrengths)
+  bool _transferMatrix;     // track spin transfer matrix (polarization for start spins x,s,z)
+  unsigned int _histogramBins; // histograms of spin distribution per output step (SpinHistograms), 0: off
+  bool _spinFiles;          // write output file for each spin
+  bool _adaptiveOutput;     // output step dt_out, dense step around resonance crossings (see OutputSchedule)
+  double _adaptiveOutputWindow; // half width of dense output window / spin tune
+  double _adaptiveOutputDt; // dense output step width / s
+  bool _spectrum;           // spin precession spectrum per window of turns (see SpinSpectrum)
+  unsigned int _spectrumWindow;   // samples per window
+  unsigned int _spectrumSampling; // turns per sample
+  unsigned int _spectrumBins;     // frequency bins
   std::string _outElement;  // output at the lattice element with this name only
                             // (wait for next occurrence after dt_out)
   bool _outElementUsed;
@@ -129,6 +150,11 @@ private:
   double _sigmaPhaseFactor; // start value for sigma_phase in units of equilibrium value
   double _sigmaGammaFactor; // start value for sigma_gamma in units of equilibrium value
   bool _checkStability;     // switch checking longitudinal motion during tracking
+  Sampling _sampling;       // start distribution (long. & transv.): pseudo-random or quasi-random sequence
+  bool _antithetic;         // start distribution: particles 2k & 2k+1 are antithetic pairs
+  bool _convergence;        // stop starting particles, when standard error of polarization < tolerance
+  double _convergenceTolerance; // standard error assumes independent samples (not halton/sobol, antithetic pairs are combined)
+  unsigned int _convergenceMinParticles;
 
   //oscillation (used with trajectoryMode oscillation only)
   pal::AccPair _emittance;  // transversal emittances
@@ -139,6 +165,12 @@ private:
   double _agammaMax;
   double _dagamma;      // spin tune output step width
   unsigned int _nTurns; // number of turns for res.strengths calculation
+  bool _nufft;          // spin tune grid via non-uniform FFT (see ResonanceSum)
+  double _nufftTolerance;
+  bool _adaptive;       // refine spin tune grid around resonances (see ParticleResStrengths::refine())
+  double _adaptiveTolerance;
+  double _adaptiveMinStep;
+  fs::path _resStrengthsCache; // directory for cached res. strengths (see ResStrengthsCache), empty: no cache
 
   pal::Metadata info;
   
@@ -170,8 +202,22 @@ public:
   GammaMode gammaMode() const {return _gammaMode;}
   std::string gammaModeString() const;
   std::string trajectoryModeString() const;
+  std::string samplingString() const;
   TrajectoryMode trajectoryMode() const {return _trajectoryMode;}
   bool edgefoc() const {return _edgefoc;}
+  bool linearFields() const {return _linearFields;}
+  bool linearFieldsCheck() const {return _linearFieldsCheck;}
+  bool trackResStrengths() const {return _trackResStrengths;}
+  bool transferMatrix() const {return _transferMatrix;}
+  unsigned int histogramBins() const {return _histogramBins;}
+  bool spinFiles() const {return _spinFiles;}
+  bool adaptiveOutput() const {return _adaptiveOutput;}
+  double adaptiveOutputWindow() const {return _adaptiveOutputWindow;}
+  double adaptiveOutputDt() const {return _adaptiveOutputDt;}
+  bool spectrum() const {return _spectrum;}
+  unsigned int spectrumWindow() const {return _spectrumWindow;}
+  unsigned int spectrumSampling() const {return _spectrumSampling;}
+  unsigned int spectrumBins() const {return _spectrumBins;}
   int seed() const {return _seed;}
   double q() const {return _q;}
   double alphac() const {return _alphac;}
@@ -180,8 +226,14 @@ public:
   double R() const {return _R;}
   double Js() const {return _Js;}
   pal::SimToolInstance& getSimToolInstance() {return *palattice;}
+  // lattice file as configured (SimToolInstance may import from cache instead)
+  std::string simToolLatticeFile() const {return _simToolConfigured.first.empty() ? palattice->inFile() : _simToolConfigured.second;}
   bool simToolRamp() const {return _simToolRamp;}
   unsigned int simToolRampSteps() const {return _simToolRampSteps;}
+  fs::path simToolCache() const {return _simToolCache;}
+  unsigned int simToolChunks() const {return _simToolChunks;}
+  double compactTrajectory() const {return _compactTrajectory;}
+  double compactGamma() const {return _compactGamma;}
   bool saveGamma(unsigned int particleId) const {return _saveGamma.at(particleId);}
   bool savePhaseSpace(unsigned int particleId) const {return _savePhaseSpace.at(particleId);}
   std::string savePhaseSpaceElement() const {return _savePhaseSpaceElement;}
@@ -190,9 +242,20 @@ public:
   pal::AccPair emittance() const {return _emittance;}
   pal::AccPair tune() const {return _tune;}
   bool checkStability() const {return _checkStability;}
+  Sampling sampling() const {return _sampling;}
+  bool antithetic() const {return _antithetic;}
+  bool convergence() const {return _convergence;}
+  double convergenceTolerance() const {return _convergenceTolerance;}
+  unsigned int convergenceMinParticles() const {return _convergenceMinParticles;}
   double agammaMin() const {return _agammaMin;}
   double agammaMax() const {return _agammaMax;}
   double dagamma() const {return _dagamma;}
+  bool nufft() const {return _nufft;}
+  double nufftTolerance() const {return _nufftTolerance;}
+  bool adaptive() const {return _adaptive;}
+  double adaptiveTolerance() const {return _adaptiveTolerance;}
+  double adaptiveMinStep() const {return _adaptiveMinStep;}
+  fs::path resStrengthsCache() const {return _resStrengthsCache;}
   std::string metadata() const {return info.out("#");}
   // #turns for resonance strengths calc are calculated from tracking duration() if not set
   unsigned int numTurns() const;
@@ -216,6 +279,19 @@ public:
   void set_gammaMode(GammaMode g) {_gammaMode=g;}
   void set_trajectoryMode(TrajectoryMode t) {_trajectoryMode=t;}
   void set_edgefoc(bool e) {_edgefoc = e;}
+  void set_linearFields(bool l) {_linearFields = l;}
+  void set_linearFieldsCheck(bool c) {_linearFieldsCheck = c;}
+  void set_trackResStrengths(bool r) {_trackResStrengths = r;}
+  void set_transferMatrix(bool t) {_transferMatrix = t;}
+  void set_histogramBins(unsigned int n) {_histogramBins = n;}
+  void set_spinFiles(bool s) {_spinFiles = s;}
+  void set_adaptiveOutput(bool a) {_adaptiveOutput = a;}
+  void set_adaptiveOutputWindow(double w);
+  void set_adaptiveOutputDt(double dt);
+  void set_spectrum(bool s) {_spectrum = s;}
+  void set_spectrumWindow(unsigned int n);
+  void set_spectrumSampling(unsigned int n);
+  void set_spectrumBins(unsigned int n);
   void set_saveGamma(std::string particleList) {set_saveList(particleList,_saveGamma,"saveGamma");}
   void set_seed(int s) {_seed=s;}
   void set_q(double q) {_q=q;}
@@ -226,6 +302,12 @@ public:
   void set_Js(double Js) {_Js=Js;}
   void set_simToolRamp(bool r) {_simToolRamp=r;}
   void set_simToolRampSteps(unsigned int n) {_simToolRampSteps=n;}
+  void set_simToolCache(fs::path p) {_simToolCache=p;}
+  void set_simToolChunks(unsigned int n) {_simToolChunks = (n==0) ? 1 : n;}
+  void set_compactTrajectory(double precision) {_compactTrajectory = std::fabs(precision);}
+  void set_compactGamma(double precision) {_compactGamma = std::fabs(precision);}
+  // import SimTool output from existing file (offline mode) instead of running SimTool, e.g. from SimToolCache
+  void set_simToolOffline(const std::string &file);
   void set_savePhaseSpaceElement(std::string name) {_savePhaseSpaceElement=name;}
   void set_savePhaseSpace(std::string particleList) {set_saveList(particleList,_savePhaseSpace,"savePhaseSpace");}
   void set_sigmaPhaseFactor(double sP) {_sigmaPhaseFactor = sP;}
@@ -237,10 +319,21 @@ public:
   void set_tune_x(double qx) {_tune.x = qx;}
   void set_tune_z(double qz) {_tune.z = qz;}
   void set_checkStability(bool c) {_checkStability = c;}
+  void set_sampling(Sampling s) {_sampling = s;}
+  void set_antithetic(bool a) {_antithetic = a;}
+  void set_convergence(bool c) {_convergence = c;}
+  void set_convergenceTolerance(double t);
+  void set_convergenceMinParticles(unsigned int n) {_convergenceMinParticles = n;}
   void set_agammaMin(double a) {_agammaMin = a;}
   void set_agammaMax(double a) {_agammaMax = a;}
   void set_dagamma(double a) {_dagamma = a;}
   void set_nTurns(unsigned int n) {_nTurns = n;}
+  void set_nufft(bool n) {_nufft = n;}
+  void set_nufftTolerance(double t);
+  void set_adaptive(bool a) {_adaptive = a;}
+  void set_adaptiveTolerance(double t);
+  void set_adaptiveMinStep(double s);
+  void set_resStrengthsCache(fs::path p) {_resStrengthsCache=p;}
   // set parameters, which are currently unset, from SimToolInstance and given lattice
   void autocomplete(const pal::AccLattice& lattice);
 
@@ -250,9 +343,13 @@ protected:
   
 public:
   double duration() const {return t_stop() - t_start();}
+  // particle tracking by SimTool needed?
+  bool simToolTracking() const {return gammaMode()==GammaMode::simtool || gammaMode()==GammaMode::simtool_plus_linear
+      || gammaMode()==GammaMode::simtool_no_interpolation || trajectoryMode()==TrajectoryMode::simtool;}
   fs::path subDirectory(std::string folder) const {return outpath()/folder;}
   fs::path spinDirectory() const {return outpath()/spinDirName;}
   fs::path polFile() const {return outpath()/polFileName;}
+  fs::path polMatrixFile() const {return outpath()/"polarizationMatrix.dat";}
   fs::path confOutFile() const {return outpath()/confOutFileName;}
   double pos_start() const {return GSL_CONST_MKSA_SPEED_OF_LIGHT * t_start();}
   double pos_stop() const {return GSL_CONST_MKSA_SPEED_OF_LIGHT * t_stop();}
@@ -278,8 +375,10 @@ public:
 
   // write energy and, if needed, number of turns to SimToolInstance
   void updateSimToolSettings(const pal::AccLattice& lattice);
+  // write number of turns & energy ramp for particle tracking to given SimToolInstance
+  void setSimToolTracking(pal::SimToolInstance& sim, const pal::AccLattice& lattice) const;
 
-  void writeRfMagnetsToLattice(pal::AccLattice& lattice) const {rf.writeToLattice(lattice);}
+  std::vector<unsigned int> writeRfMagnetsToLattice(pal::AccLattice& lattice) const {return rf.writeToLattice(lattice);}
 
 };
 
@@ -0,0 +1,226 @@
+/* Depolarization Classes
+ * fast linear estimate of radiative depolarization (no tracking).
+ * The spin-orbit coupling function d = gamma*dn/dgamma is calculated from the invariant
+ * spin axis on the dispersive orbit (closed orbit + dispersion*delta) for energy deviations +-delta.
+ * Derbenev-Kondratenko formula integrated over all dipoles gives equilibrium polarization and
+ * polarization/depolarization times for each energy of the spin tune grid (agammaGrid()).
+ * Only synchrotron (energy) spin-orbit coupling is included, no betatron contributions.
+ *
+ * Copyright (C) 2017 Jan Felix Schmidt <janschmidt@mailbox.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <iomanip>
+#include <cmath>
+#include "Depolarization.hpp"
+#include "TrackingTask.hpp"
+#include "ResStrengths.hpp" // agammaGrid()
+
+const double deltaStep = 1e-5;  // relative energy deviation to calculate d = dn/ddelta
+
+
+DepolarizationTask::DepolarizationTask(unsigned int id, const std::shared_ptr<Configuration> c, double a,
+				       std::shared_ptr<const pal::FunctionOfPos<pal::AccPair>> disp)
+  : SpinTuneTask(id,c,a), dispersion(disp), polBKS(0.), polDK(0.), tauBKS(0.), tauDep(0.), dMean(0.), dMax(0.)
+{
+}
+
+
+// fields on orbit+dispersion*delta, normalized to momentum of the particle.
+// bending angles sum up to 2pi*(1+delta) (definition of dispersion), so the spin tune is agamma*(1+delta)
+void DepolarizationTask::spinAxes(double delta, std::vector<arma::colvec3> &nAxis, double &tune) const
+{
+  double gamma = agamma / config->a_gyro * (1.+delta);
+  arma::colvec3 guideField = {0.,0.,0.};
+  arma::mat33 M;
+  M.eye();
+  std::vector<arma::mat33> before; // map from lattice begin to element entrance
+  std::vector<arma::mat33> after;  // map from lattice begin to element exit
+  before.reserve(lattice->size());
+  after.reserve(lattice->size());
+  for (auto it=lattice->begin(); it!=lattice->end(); ++it) {
+    pal::AccPair traj = orbit->interp(it.pos()) + dispersion->interp(it.pos()) * delta;
+    pal::AccTriple omega = it.element()->B_int(traj);
+    if (config->edgefoc() && it.element()->type == pal::dipole)
+      omega.x += ElementFields::edgeBx(it.element(), traj.z);
+    omega = omega * (1./(1.+delta));
+    guideField += arma::colvec3({omega.x, omega.s, omega.z});
+    omega = omega * config->a_gyro;
+    omega.x *= gamma;
+    omega.z *= gamma;
+    before.push_back(M);
+    M = TrackingTask::rotMatrix(omega) * M;
+    after.push_back(M);
+  }
+
+  arma::colvec3 nStart;
+  invariantAxis(M, guideField, nStart, tune);
+  nAxis.resize(before.size());
+  for (unsigned int i=0; i<before.size(); i++)
+    nAxis[i] = arma::normalise( before[i]*nStart + after[i]*nStart );
+}
+
+
+// Derbenev-Kondratenko (only dipoles, B perpendicular to s):
+// P = -8/(5sqrt3) * <b*(n-d)/|R|^3> / <(1 - 2/9 (n*s)^2 + 11/18 d^2)/|R|^3>
+// 1/tau = 5sqrt3/8 * r_e*hbar*gamma^5/m_e * 1/C * integral ds (...)/|R|^3
+void DepolarizationTask::run()
+{
+  if (!dispersion || dispersion->size() == 0)
+    throw std::runtime_error("DepolarizationTask: dispersion not available");
+
+  double tune;
+  std::vector<arma::colvec3> nPlus, nMinus;
+  spinAxes(0., n, spinTune);
+  spinAxes(deltaStep, nPlus, tune);
+  spinAxes(-deltaStep, nMinus, tune);
+  d.resize(n.size());
+  for (unsigned int i=0; i<n.size(); i++)
+    d[i] = (nPlus[i] - nMinus[i]) / (2*deltaStep);
+
+  double bn=0., bd=0., st=0., dd=0.;
+  dMax = 0.;
+  unsigned int i=0;
+  for (auto it=lattice->begin(); it!=lattice->end(); ++it, i++) {
+    if (it.element()->type != pal::dipole)
+      continue;
+    double R = std::fabs(((pal::Dipole*)it.element())->R());
+    double w = it.element()->length / (R*R*R);
+    pal::AccTriple B = it.element()->B_int(orbit->interp(it.pos()));
+    arma::colvec3 b = arma::normalise( arma::colvec3({B.x, B.s, B.z}) );
+    bn += w * arma::dot(b, n[i]);
+    bd += w * arma::dot(b, d[i]);
+    st += w * (1. - 2./9. * n[i](1)*n[i](1));
+    dd += w * arma::dot(d[i], d[i]);
+    dMax = std::max(dMax, arma::norm(d[i]));
+  }
+  if (st == 0.)
+    throw std::runtime_error("DepolarizationTask: no dipoles in lattice");
+
+  polBKS = 8./(5*std::sqrt(3.)) * std::fabs(bn) / st;
+  polDK = 8./(5*std::sqrt(3.)) * std::fabs(bn - bd) / (st + 11./18.*dd);
+  dMean = std::sqrt(dd / st);
+
+  double r_e = std::pow(GSL_CONST_MKSA_ELECTRON_CHARGE,2)
+    / (4*M_PI*GSL_CONST_MKSA_VACUUM_PERMITTIVITY*GSL_CONST_MKSA_MASS_ELECTRON*std::pow(GSL_CONST_MKSA_SPEED_OF_LIGHT,2));
+  double gamma = agamma / config->a_gyro;
+  double rate = 5*std::sqrt(3.)/8. * r_e*GSL_CONST_MKSA_PLANCKS_CONSTANT_HBAR*std::pow(gamma,5)
+    / GSL_CONST_MKSA_MASS_ELECTRON / lattice->circumference();
+  tauBKS = 1. / (rate * st);
+  tauDep = (dd > 0.) ? 1. / (rate * 11./18.*dd) : INFINITY;
+  done = true;
+}
+
+
+
+
+// dispersion is read from SimTool twiss output. only the closed orbit is needed: no SimTool particle tracking
+DepolarizationEstimate::DepolarizationEstimate(const std::shared_ptr<Configuration> c, unsigned int nThreads)
+  : Simulation(c, nThreads)
+{
+  showProgressBar = false;
+  config->set_trajectoryMode(TrajectoryMode::closed_orbit);
+  if (config->simToolTracking())
+    config->set_gammaMode(GammaMode::linear);
+}
+
+
+void DepolarizationEstimate::start()
+{
+  std::string dx, dz;
+  if (config->getSimToolInstance().tool == pal::madx) {
+    dx = "DX";
+    dz = "DY";
+  }
+  else if (config->getSimToolInstance().tool == pal::elegant) {
+    dx = "etax";
+    dz = "etay";
+  }
+  dispersion.reset( new pal::FunctionOfPos<pal::AccPair>(config->getSimToolInstance()) );
+  dispersion->readTwissColumn(config->getSimToolInstance(), dx, dz);
+
+  std::vector<double> grid = agammaGrid(*config);
+  queue.clear();
+  for (unsigned int i=0; i<grid.size(); i++)
+    queue.emplace_back( DepolarizationTask(i, config, grid[i], dispersion) );
+  queueIt = queue.begin();
+
+  startThreads();
+  waitForThreads();
+  std::cout << printErrors();
+}
+
+
+std::string DepolarizationEstimate::print() const
+{
+  const unsigned int w = 16;
+  std::stringstream s;
+  s << "#"<<std::setw(w)<< "agamma" <<std::setw(w)<< "E / GeV" <<std::setw(w)<< "spin tune"
+    <<std::setw(w)<< "P_BKS" <<std::setw(w)<< "P_DK" <<std::setw(w)<< "tau_BKS / s"
+    <<std::setw(w)<< "tau_dep / s" <<std::setw(w)<< "tau_DK / s" <<std::setw(w)<< "rms |d|" <<std::setw(w)<< "max |d|" << std::endl;
+  for (auto &task : queue) {
+    if (errors.count(task.particleId) > 0)
+      continue;
+    s <<resetiosflags(ios::scientific)<<setiosflags(ios::fixed)<<setprecision(6)
+      <<std::setw(1+w)<< task.agamma <<std::setw(w)<< task.agamma/config->a_gyro * config->E_rest_GeV
+      <<std::setw(w)<< task.spinTune <<std::setw(w)<< task.polBKS <<std::setw(w)<< task.polDK
+      <<resetiosflags(ios::fixed)<<setiosflags(ios::scientific)<<showpoint<<setprecision(5)
+      <<std::setw(w)<< task.tauBKS <<std::setw(w)<< task.tauDep <<std::setw(w)<< task.tauDK()
+      <<std::setw(w)<< task.dMean <<std::setw(w)<< task.dMax << std::endl;
+  }
+  return s.str();
+}
+
+
+void DepolarizationEstimate::save() const
+{
+  std::string filename = (config->outpath()/"depolarization.dat").string();
+  std::ofstream file(filename);
+  if (!file.is_open())
+    throw std::runtime_error("Cannot open " + filename);
+  file << config->metadata();
+  file << "# linear estimate of radiative depolarization: Derbenev-Kondratenko formula with" << std::endl
+       << "# spin-orbit coupling d = gamma*dn/dgamma on dispersive orbit (no betatron contributions)" << std::endl;
+  file << print();
+  file.close();
+  std::cout << "* Wrote " << filename << std::endl;
+}
+
+
+void DepolarizationEstimate::saveCoupling() const
+{
+  if (queue.empty() || errors.count(queue.front().particleId) > 0)
+    return;
+  const DepolarizationTask &task = queue.front();
+  std::string filename = (config->outpath()/"spin-orbit-coupling.dat").string();
+  std::ofstream file(filename);
+  if (!file.is_open())
+    throw std::runtime_error("Cannot open " + filename);
+  file << config->metadata();
+  file << "# n-axis and spin-orbit coupling function d = gamma*dn/dgamma at agamma = " << task.agamma << std::endl;
+  const unsigned int w = 14;
+  file << "#"<<std::setw(w)<< "s / m" <<std::setw(w)<< "name"
+       <<std::setw(w)<< "nx" <<std::setw(w)<< "nz" <<std::setw(w)<< "ns"
+       <<std::setw(w)<< "dx" <<std::setw(w)<< "dz" <<std::setw(w)<< "ds" << std::endl;
+  file <<setiosflags(ios::scientific)<<showpoint<<setprecision(5);
+  unsigned int i=0;
+  for (auto it=lattice->begin(); it!=lattice->end(); ++it, i++) {
+    file <<std::setw(w+1)<< it.pos() <<std::setw(w)<< it.element()->name
+	 <<std::setw(w)<< task.n[i](0) <<std::setw(w)<< task.n[i](2) <<std::setw(w)<< task.n[i](1)
+	 <<std::setw(w)<< task.d[i](0) <<std::setw(w)<< task.d[i](2) <<std::setw(w)<< task.d[i](1) << std::endl;
+  }
+  file.close();
+  std::cout << "* Wrote " << filename << std::endl;
+}
@@ -0,0 +1,78 @@
+/* Depolarization Classes
+ * fast linear estimate of radiative depolarization (no tracking).
+ * The spin-orbit coupling function d = gamma*dn/dgamma is calculated from the invariant
+ * spin axis on the dispersive orbit (closed orbit + dispersion*delta) for energy deviations +-delta.
+ * Derbenev-Kondratenko formula integrated over all dipoles gives equilibrium polarization and
+ * polarization/depolarization times for each energy of the spin tune grid (agammaGrid()).
+ * Only synchrotron (energy) spin-orbit coupling is included, no betatron contributions.
+ *
+ * Copyright (C) 2017 Jan Felix Schmidt <janschmidt@mailbox.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __POLEMATRIX__DEPOLARIZATION_HPP_
+#define __POLEMATRIX__DEPOLARIZATION_HPP_
+
+#include <string>
+#include <vector>
+#include "SpinTuneSolver.hpp"
+
+
+// spin-orbit coupling & Derbenev-Kondratenko integrals at a single energy (given as agamma)
+class DepolarizationTask : public SpinTuneTask {
+protected:
+  std::shared_ptr<const pal::FunctionOfPos<pal::AccPair>> dispersion;
+
+  // n-axis at each element (mean of entrance & exit) for relative energy deviation delta
+  void spinAxes(double delta, std::vector<arma::colvec3> &n, double &tune) const;
+
+public:
+  std::vector<arma::colvec3> n;  // n-axis at each element (x,s,z)
+  std::vector<arma::colvec3> d;  // spin-orbit coupling function gamma*dn/dgamma at each element
+  double polBKS;                 // |equilibrium polarization| without depolarization (Sokolov-Ternov)
+  double polDK;                  // |equilibrium polarization| (Derbenev-Kondratenko)
+  double tauBKS;                 // polarization time / s
+  double tauDep;                 // depolarization time / s
+  double dMean;                  // rms |d| in dipoles weighted by 1/|R|^3
+  double dMax;                   // max. |d| in dipoles
+
+  DepolarizationTask(unsigned int id, const std::shared_ptr<Configuration> c, double a,
+		     std::shared_ptr<const pal::FunctionOfPos<pal::AccPair>> disp);
+  DepolarizationTask(const DepolarizationTask& other) = delete;
+  DepolarizationTask(DepolarizationTask&& other) = default;
+
+  void run();
+  double tauDK() const {return 1. / (1./tauBKS + 1./tauDep);}  // total polarization time / s
+};
+
+
+// depolarization estimate for all energies of the resonance strengths spin tune grid (agammaGrid())
+class DepolarizationEstimate : public Simulation<DepolarizationTask> {
+protected:
+  std::shared_ptr<pal::FunctionOfPos<pal::AccPair>> dispersion;
+
+public:
+  DepolarizationEstimate(const std::shared_ptr<Configuration> c, unsigned int nThreads=std::thread::hardware_concurrency());
+  DepolarizationEstimate(const DepolarizationEstimate& o) = delete;
+
+  void start();
+  std::string print() const;
+  void save() const;
+  void saveCoupling() const;  // n & d along the lattice for first energy
+};
+
+
+#endif
+// __POLEMATRIX__DEPOLARIZATION_HPP_
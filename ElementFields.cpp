@@ -0,0 +1,109 @@
+/* ElementFields Class
+ * magnetic fields of all lattice elements, which are the same for all particles
+ * and turns (particle on closed orbit). Calculated once per model and shared by all tasks.
+ *
+ * Copyright (C) 2017 Jan Felix Schmidt <janschmidt@mailbox.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include "ElementFields.hpp"
+
+const double linearStep = 1e-3;  // m, step to calculate field gradients
+
+
+void ElementFields::initOrbit(const pal::AccLattice &lattice, const pal::FunctionOfPos<pal::AccPair> &orbit, bool edgefoc)
+{
+  orbitBint.clear();
+  orbitEdgeBx.clear();
+  orbitBint.reserve(lattice.size());
+  orbitEdgeBx.reserve(lattice.size());
+  for (auto it=lattice.begin(); it!=lattice.end(); ++it) {
+    pal::AccPair co = orbit.interp( it.pos() );
+    orbitBint.push_back( it.element()->B_int(co) );
+    if (edgefoc && it.element()->type == pal::dipole)
+      orbitEdgeBx.push_back( edgeBx(it.element(), co.z) );
+    else
+      orbitEdgeBx.push_back(0.);
+  }
+}
+
+
+// gradients from field differences are exact for affine fields
+void ElementFields::initLinear(const pal::AccLattice &lattice)
+{
+  linearBint.clear();
+  linearBint.reserve(lattice.size());
+  pal::AccPair zero, x, z;
+  x.x = linearStep;
+  z.z = linearStep;
+  auto gradient = [](const pal::AccTriple &B, const pal::AccTriple &B0) {
+    pal::AccTriple d;
+    d.x = (B.x - B0.x) / linearStep;
+    d.z = (B.z - B0.z) / linearStep;
+    d.s = (B.s - B0.s) / linearStep;
+    return d;
+  };
+  for (auto it=lattice.begin(); it!=lattice.end(); ++it) {
+    LinearField l;
+    l.B0 = it.element()->B_int(zero);
+    l.dBdx = gradient(it.element()->B_int(x), l.B0);
+    l.dBdz = gradient(it.element()->B_int(z), l.B0);
+    l.valid = affine(it.element(), l);
+    linearBint.push_back(l);
+  }
+}
+
+
+// nonlinear element types or deviation from linear field at test positions
+bool ElementFields::affine(const pal::AccElement *element, const LinearField &l)
+{
+  if (element->type == pal::sextupole || element->type == pal::multipole)
+    return false;
+
+  pal::AccPair test[2];
+  test[0].x = linearStep;
+  test[0].z = linearStep;
+  test[1].x = -2*linearStep;
+  test[1].z = 3*linearStep;
+  for (const pal::AccPair &t : test) {
+    pal::AccTriple B = element->B_int(t);
+    pal::AccTriple L;
+    L.x = l.B0.x + l.dBdx.x*t.x + l.dBdz.x*t.z;
+    L.z = l.B0.z + l.dBdx.z*t.x + l.dBdz.z*t.z;
+    L.s = l.B0.s + l.dBdx.s*t.x + l.dBdz.s*t.z;
+    double tolerance = 1e-9 * std::max({std::fabs(B.x), std::fabs(B.z), std::fabs(B.s), 1e-6});
+    if (std::fabs(B.x-L.x) > tolerance || std::fabs(B.z-L.z) > tolerance || std::fabs(B.s-L.s) > tolerance)
+      return false;
+  }
+  return true;
+}
+
+
+void ElementFields::initRf(unsigned int numElements, const std::vector<unsigned int> &rfElements)
+{
+  rfMagnets.assign(numElements, -1);
+  numRf = 0;
+  for (unsigned int index : rfElements) {
+    if (rfMagnets.at(index) < 0)
+      rfMagnets[index] = numRf++;
+  }
+}
+
+
+unsigned int ElementFields::numLinear() const
+{
+  return std::count_if(linearBint.begin(), linearBint.end(), [](const LinearField &l){return l.valid;});
+}
@@ -0,0 +1,90 @@
+/* ElementFields Class
+ * magnetic fields of all lattice elements, calculated once per model and shared by all tasks:
+ * - fields at closed orbit, which are the same for all particles and turns
+ * - linearized fields B_int(x,z) = B0 + dB/dx*x + dB/dz*z for elements with fields affine in x,z
+ * - rf magnets (elements with time dependent field, see RfMagnetConfig)
+ *
+ * Copyright (C) 2017 Jan Felix Schmidt <janschmidt@mailbox.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __POLEMATRIX__ELEMENTFIELDS_HPP_
+#define __POLEMATRIX__ELEMENTFIELDS_HPP_
+
+#include <vector>
+#include <cmath>
+#include <libpalattice/AccLattice.hpp>
+#include <libpalattice/FunctionOfPos.hpp>
+#include <libpalattice/types.hpp>
+
+
+class ElementFields
+{
+protected:
+  struct LinearField {
+    pal::AccTriple B0;     // B_int(0,0)
+    pal::AccTriple dBdx;
+    pal::AccTriple dBdz;
+    bool valid;            // false: field not affine (e.g. sextupole), use B_int()
+  };
+
+  // index as in lattice
+  std::vector<pal::AccTriple> orbitBint;  // integral field at closed orbit
+  std::vector<double> orbitEdgeBx;        // Bx from edge focusing at closed orbit (not scaled by rf magnets)
+  std::vector<LinearField> linearBint;    // linearized integral field
+  std::vector<int> rfMagnets;             // number of rf magnet, -1: no rf magnet
+  unsigned int numRf;
+
+  static bool affine(const pal::AccElement *element, const LinearField &l);
+
+public:
+  ElementFields() : numRf(0) {}
+
+  void initOrbit(const pal::AccLattice &lattice, const pal::FunctionOfPos<pal::AccPair> &orbit, bool edgefoc);
+  void initLinear(const pal::AccLattice &lattice);
+  void initRf(unsigned int numElements, const std::vector<unsigned int> &rfElements);
+  bool hasOrbit() const {return !orbitBint.empty();}
+  bool hasLinear() const {return !linearBint.empty();}
+  bool hasRf() const {return !rfMagnets.empty();}
+
+  // closed orbit
+  const pal::AccTriple& Bint(unsigned int index) const {return orbitBint[index];}
+  double edgeBx(unsigned int index) const {return orbitEdgeBx[index];}
+
+  // linearized
+  bool linear(unsigned int index) const {return linearBint[index].valid;}
+  pal::AccTriple Bint(unsigned int index, const pal::AccPair &traj) const {
+    const LinearField &l = linearBint[index];
+    pal::AccTriple B;
+    B.x = l.B0.x + l.dBdx.x*traj.x + l.dBdz.x*traj.z;
+    B.z = l.B0.z + l.dBdx.z*traj.x + l.dBdz.z*traj.z;
+    B.s = l.B0.s + l.dBdx.s*traj.x + l.dBdz.s*traj.z;
+    return B;
+  }
+  unsigned int numLinear() const;
+
+  // rf magnets
+  int rfMagnet(unsigned int index) const {return rfMagnets[index];}
+  unsigned int numRfMagnets() const {return numRf;}
+
+  // Dipole: Bx from edge focussing (! uses vertical trajectory z at "pos" for magnet entrance and exit)
+  static double edgeBx(const pal::AccElement *element, double z) {
+    return - ( std::tan(element->e1) + std::tan(element->e2) )/(1./element->k0.z) * z;
+  }
+};
+
+
+#endif
+// __POLEMATRIX__ELEMENTFIELDS_HPP_
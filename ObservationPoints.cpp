@@ -0,0 +1,73 @@
+/* ObservationPoints Class
+ * lattice elements with output during spin tracking: spin output at config <outElement>
+ * (comma separated list, each element has its own polarization output) and
+ * longitudinal phase space output at config <savePhaseSpace><elementName>.
+ * Element names are resolved to lattice indices once, so tracking only checks a flag per element.
+ * The output times are given by the OutputSchedule.
+ *
+ * Copyright (C) 2017 Jan Felix Schmidt <janschmidt@mailbox.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sstream>
+#include <stdexcept>
+#include "ObservationPoints.hpp"
+
+
+void ObservationPoints::init(const pal::AccLattice &lattice, const Configuration &config)
+{
+  names.clear();
+  if (config.outElementUsed())
+    names = split(config.outElement());
+  outputs.assign(lattice.size(), -1);
+  phaseSpaceFlags.assign(lattice.size(), false);
+  timeSchedule.init(config);
+
+  std::vector<bool> found(names.size(), false);
+  unsigned int i=0;
+  for (auto it=lattice.begin(); it!=lattice.end(); ++it, i++) {
+    const std::string &element = it.element()->name;
+    for (unsigned int k=0; k<names.size(); k++) {
+      if (element == names[k]) {
+	outputs[i] = k;
+	found[k] = true;
+	break;
+      }
+    }
+    if (!config.savePhaseSpaceElement().empty() && element == config.savePhaseSpaceElement())
+      phaseSpaceFlags[i] = true;
+  }
+
+  for (unsigned int k=0; k<names.size(); k++) {
+    if (!found[k])
+      throw std::runtime_error("ObservationPoints: outElement " + names[k] + " not found in lattice");
+  }
+}
+
+
+std::vector<std::string> ObservationPoints::split(const std::string &list)
+{
+  std::vector<std::string> result;
+  std::stringstream s(list);
+  std::string name;
+  while (std::getline(s, name, ',')) {
+    auto first = name.find_first_not_of(" \t");
+    if (first == std::string::npos)
+      continue;
+    auto last = name.find_last_not_of(" \t");
+    result.push_back( name.substr(first, last-first+1) );
+  }
+  return result;
+}
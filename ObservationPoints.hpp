@@ -0,0 +1,61 @@
+/* ObservationPoints Class
+ * lattice elements with output during spin tracking: spin output at config <outElement>
+ * (comma separated list, each element has its own polarization output) and
+ * longitudinal phase space output at config <savePhaseSpace><elementName>.
+ * Element names are resolved to lattice indices once, so tracking only checks a flag per element.
+ * The output times are given by the OutputSchedule.
+ *
+ * Copyright (C) 2017 Jan Felix Schmidt <janschmidt@mailbox.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __POLEMATRIX__OBSERVATIONPOINTS_HPP_
+#define __POLEMATRIX__OBSERVATIONPOINTS_HPP_
+
+#include <vector>
+#include <string>
+#include <libpalattice/AccLattice.hpp>
+#include "Configuration.hpp"
+#include "OutputSchedule.hpp"
+
+
+class ObservationPoints
+{
+protected:
+  std::vector<std::string> names;     // output elements (config <outElement>)
+  std::vector<int> outputs;           // per lattice index: number of output element, -1: none
+  std::vector<bool> phaseSpaceFlags;  // per lattice index: long. phase space output
+  OutputSchedule timeSchedule;        // output times (config <dt_out>, <adaptiveOutput>)
+
+public:
+  // throws, if an output element is not found in lattice
+  void init(const pal::AccLattice &lattice, const Configuration &config);
+
+  // output elements: 0 means output at any element
+  unsigned int size() const {return names.size();}
+  const std::string& name(unsigned int i) const {return names[i];}
+
+  // output element number at lattice index, -1: no output element.
+  // without output elements all indices are output 0
+  int output(unsigned int index) const {return names.empty() ? 0 : outputs[index];}
+  bool phaseSpace(unsigned int index) const {return phaseSpaceFlags[index];}
+  const OutputSchedule& schedule() const {return timeSchedule;}
+
+  static std::vector<std::string> split(const std::string &list); // comma separated names
+};
+
+
+#endif
+// __POLEMATRIX__OBSERVATIONPOINTS_HPP_
@@ -0,0 +1,144 @@
+/* OutputSchedule Class
+ * times of the output steps during spin tracking: uniform with config <dt_out> or
+ * adaptive (config <adaptiveOutput>) with dense output step around spin resonance crossings.
+ * Resonances are agamma = n and agamma = n +- Q for the configured tunes Qx, Qz,
+ * the crossing times follow from Configuration::agamma(t).
+ *
+ * Copyright (C) 2017 Jan Felix Schmidt <janschmidt@mailbox.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <sstream>
+#include "OutputSchedule.hpp"
+
+
+void OutputSchedule::init(const Configuration &config)
+{
+  t0 = config.t_start();
+  dt = config.dt_out();
+  // all steps t0 + i*dt < t_stop are reached by the tracking (usually outSteps()+1)
+  nUniform = config.outSteps();
+  while (nUniform > 0 && t0 + (nUniform-1)*dt >= config.t_stop())
+    nUniform--;
+  while (t0 + nUniform*dt < config.t_stop())
+    nUniform++;
+  times.clear();
+  res.clear();
+  crossings.clear();
+  if (!config.adaptiveOutput())
+    return;
+
+  window = config.adaptiveOutputWindow();
+  dtDense = config.adaptiveOutputDt();
+  double t_stop = config.t_stop();
+  // energy ramp is monotonic, so the spin tune range is given by start & stop
+  double a_start = config.agamma_start();
+  double a_stop = config.agamma_stop();
+  res = resonances(std::min(a_start,a_stop), std::max(a_start,a_stop), config.tune());
+
+  // all uniform steps. in between dense steps (grid t_start + k*dtDense) close to resonances.
+  // agamma is monotonic within a step, so resonances between both ends are crossed
+  for (unsigned int i=0; t0 + i*dt < t_stop; i++) {
+    double t1 = t0 + i*dt;
+    double t2 = std::min(t1+dt, t_stop);
+    double a1 = config.agamma(t1);
+    double a2 = config.agamma(t2);
+    double aMin = std::min(a1,a2);
+    double aMax = std::max(a1,a2);
+    times.push_back(t1);
+
+    auto first = std::lower_bound(res.begin(), res.end(), aMin-window);
+    if (first == res.end() || *first > aMax+window)
+      continue;
+    for (auto r=first; r!=res.end() && *r<aMax; ++r) {
+      if (*r >= aMin)
+	crossings.push_back( std::make_pair(*r, t1 + (*r-a1)/(a2-a1)*(t2-t1)) );
+    }
+    for (unsigned long k=std::ceil((t1-t0)/dtDense); ; k++) {
+      double t = t0 + k*dtDense;
+      if (t >= t2 - 0.5*dtDense)
+	break;
+      if (t - times.back() > 0.5*dtDense && distance(config.agamma(t)) < window)
+	times.push_back(t);
+    }
+  }
+}
+
+
+double OutputSchedule::distance(double agamma) const
+{
+  double d = std::numeric_limits<double>::infinity();
+  auto next = std::lower_bound(res.begin(), res.end(), agamma);
+  if (next != res.end())
+    d = *next - agamma;
+  if (next != res.begin())
+    d = std::min(d, agamma - *(next-1));
+  return d;
+}
+
+
+double OutputSchedule::time(unsigned int step) const
+{
+  if (!adaptive())
+    return t0 + step*dt;
+  else if (step < times.size())
+    return times[step];
+  else
+    return std::numeric_limits<double>::infinity();
+}
+
+
+std::string OutputSchedule::printCrossings() const
+{
+  std::stringstream s;
+  if (!adaptive())
+    return s.str();
+  s << "# Adaptive output: " << steps() << " steps, step width " << dt << " s, "
+    << dtDense << " s within spin tune +-" << window << " of resonances" << std::endl;
+  s << "# Resonance crossings (spin tune @ t / s):";
+  for (auto &c : crossings)
+    s << " " << c.first << " @ " << c.second;
+  if (crossings.empty())
+    s << " none";
+  s << std::endl;
+  return s.str();
+}
+
+
+// fractional tunes 0 are ignored (tunes not configured)
+std::vector<double> OutputSchedule::resonances(double agammaMin, double agammaMax, pal::AccPair tune)
+{
+  std::vector<double> q;
+  for (double Q : {tune.x, tune.z}) {
+    double f = Q - std::floor(Q);
+    if (f > 0.)
+      q.push_back(f);
+  }
+
+  std::vector<double> r;
+  for (int n=std::floor(agammaMin)-1; n<=std::ceil(agammaMax)+1; n++) {
+    r.push_back(n);
+    for (double f : q) {
+      r.push_back(n+f);
+      r.push_back(n-f);
+    }
+  }
+  std::sort(r.begin(), r.end());
+  r.erase( std::unique(r.begin(), r.end()), r.end() );
+  return r;
+}
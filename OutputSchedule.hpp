@@ -0,0 +1,63 @@
+/* OutputSchedule Class
+ * times of the output steps during spin tracking: uniform with config <dt_out> or
+ * adaptive (config <adaptiveOutput>) with dense output step around spin resonance crossings.
+ * Resonances are agamma = n and agamma = n +- Q for the configured tunes Qx, Qz,
+ * the crossing times follow from Configuration::agamma(t).
+ *
+ * Copyright (C) 2017 Jan Felix Schmidt <janschmidt@mailbox.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __POLEMATRIX__OUTPUTSCHEDULE_HPP_
+#define __POLEMATRIX__OUTPUTSCHEDULE_HPP_
+
+#include <vector>
+#include <string>
+#include <utility>
+#include "Configuration.hpp"
+
+
+class OutputSchedule
+{
+protected:
+  double t0;                     // uniform output: t_start
+  double dt;                     // uniform output: dt_out
+  unsigned int nUniform;         // uniform output: number of steps before t_stop
+  std::vector<double> times;     // adaptive output: times of all steps, empty: uniform output
+  std::vector<double> res;       // resonance spin tunes (sorted)
+  std::vector<std::pair<double,double>> crossings; // (resonance spin tune, crossing time)
+  double window;                 // half width of dense output window / spin tune
+  double dtDense;                // dense output step width
+
+  double distance(double agamma) const; // spin tune distance to next resonance
+
+public:
+  OutputSchedule() : t0(0.), dt(1.), nUniform(0), window(0.), dtDense(0.) {}
+  void init(const Configuration &config);
+
+  bool adaptive() const {return !times.empty();}
+  unsigned int steps() const {return adaptive() ? times.size() : nUniform;} // all steps before t_stop
+  double time(unsigned int step) const;  // time of output step, after last step: infinity
+  double pos(unsigned int step) const {return GSL_CONST_MKSA_SPEED_OF_LIGHT * time(step);}
+
+  std::string printCrossings() const;    // comment lines for output files
+
+  // integer (n) and first order intrinsic (n +- Q) resonances in spin tune range
+  static std::vector<double> resonances(double agammaMin, double agammaMax, pal::AccPair tune);
+};
+
+
+#endif
+// __POLEMATRIX__OUTPUTSCHEDULE_HPP_
@@ -19,6 +19,7 @@
  */
 
 #include "RadiationModel.hpp"
+#include "StartDistribution.hpp"
 #include "debug.hpp"
 #include "gsl/gsl_sf_synchrotron.h"
 
@@ -93,7 +94,7 @@ double SynchrotronRadiationModel::radiatedEnergy(const pal::AccElement* element,
 
 
 
-void LongitudinalPhaseSpaceModel::init(std::shared_ptr<const pal::AccLattice> l)
+void LongitudinalPhaseSpaceModel::init(std::shared_ptr<const pal::AccLattice> l, std::shared_ptr<const StartSequence> q)
 {  
   //gamma0 & pos start from config
   lastPos = config->pos_start();
@@ -101,14 +102,21 @@ void LongitudinalPhaseSpaceModel::init(std::shared_ptr<const pal::AccLattice> l)
   nCavities = lattice->size(pal::cavity);
   set_gamma0(config->gamma_start());
 
-  // init statistical distributions:
-  boost::random::normal_distribution<> phaseDistribution(ref_phase(), sigma_phase());
-  boost::random::normal_distribution<> gammaDistribution(gamma0(), sigma_gamma());
-  
   //initial phase space coordinate for this particle
-  boost::random::mt11213b initrng(seed);
-  _gamma =  gammaDistribution(initrng);
-  _phase = phaseDistribution(initrng);
+  if (StartDistribution::used(*config)) {
+    StartDistribution start(*config, particleId, q.get());
+    _gamma = start.normal(StartDistribution::energy, gamma0(), sigma_gamma());
+    _phase = start.normal(StartDistribution::synchrotronPhase, ref_phase(), sigma_phase());
+  }
+  else {
+    // init statistical distributions:
+    boost::random::normal_distribution<> phaseDistribution(ref_phase(), sigma_phase());
+    boost::random::normal_distribution<> gammaDistribution(gamma0(), sigma_gamma());
+
+    boost::random::mt11213b initrng(seed);
+    _gamma =  gammaDistribution(initrng);
+    _phase = phaseDistribution(initrng);
+  }
 }
 
 
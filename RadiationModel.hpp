@@ -27,6 +27,7 @@
 #include <boost/random/piecewise_linear_distribution.hpp>
 #include "libpalattice/AccLattice.hpp"
 #include "Configuration.hpp"
+#include "StartDistribution.hpp"
 
 
 class SynchrotronRadiationModel {
@@ -54,6 +55,7 @@ public:
 class LongitudinalPhaseSpaceModel {
 protected:
   int seed;
+  unsigned int particleId;
   SynchrotronRadiationModel radModel;        // stochastical model for radiation
   std::shared_ptr<const pal::AccLattice> lattice;
   const std::shared_ptr<const Configuration> config;
@@ -70,8 +72,8 @@ protected:
 
 
 public:
-  LongitudinalPhaseSpaceModel(int _seed, std::shared_ptr<const Configuration> c)
-    : seed(_seed),radModel(seed), config(c) {lastPos=_phase=_gamma=_gamma0=_gammaU0=0;}
+  LongitudinalPhaseSpaceModel(int _seed, std::shared_ptr<const Configuration> c, unsigned int id=0)
+    : seed(_seed), particleId(id), radModel(seed), config(c) {lastPos=_phase=_gamma=_gamma0=_gammaU0=0;}
   double gammaU0() const {return _gammaU0;}
   double gamma0() const {return _gamma0;}
   double phase() const {return _phase;}
@@ -84,7 +86,7 @@ public:
   double gammaMinusGamma0() const {return gamma()-gamma0();}
   double dphase() const {return phase() - ref_phase();}
 
-  void init(std::shared_ptr<const pal::AccLattice> l);
+  void init(std::shared_ptr<const pal::AccLattice> l, std::shared_ptr<const StartSequence> q=nullptr);
   void update(const pal::AccElement* element, const double& pos, const double& newGamma0);
 
   void checkStability() const;
@@ -23,10 +23,22 @@
  * BNL–51270 and UC–28 and ISA–80–5 (1980).
  */
 
+#include <set>
 #include "ResStrengths.hpp"
+#include "ResonanceSums.hpp"
 #include "debug.hpp"
 
 
+// spin tune grid agammaMin...agammaMax as used for res. strength output
+std::vector<double> agammaGrid(const Configuration &config)
+{
+  std::vector<double> grid;
+  for (double agamma=config.agammaMin(); agamma<=config.agammaMax(); agamma+=config.dagamma())
+    grid.push_back(agamma);
+  return grid;
+}
+
+
 // get res. strength from cache
 std::complex<double> ResStrengthsData::operator[](double agamma)
 {
@@ -49,6 +61,29 @@ std::complex<double> ResStrengthsData::get(double agamma)
 }
 
 
+// linear interpolation between cached spin tunes (e.g. other particle refined adaptive grid there)
+std::complex<double> ResStrengthsData::interpolate(double agamma) const
+{
+  auto next = cache.lower_bound(agamma);
+  if (next != cache.end() && next->first == agamma)
+    return next->second;
+  if (next == cache.end() || next == cache.begin())
+    throw std::runtime_error("Resonance Strength not known for requested spin tune");
+  auto prev = std::prev(next);
+  double w = (agamma - prev->first) / (next->first - prev->first);
+  return prev->second + w * (next->second - prev->second);
+}
+
+
+std::vector<double> ResStrengthsData::spinTunes() const
+{
+  std::vector<double> agammas;
+  for (auto &it : cache)
+    agammas.push_back(it.first);
+  return agammas;
+}
+
+
 void ResStrengthsData::cacheIt(double agamma, const std::complex<double>& epsilon)
 {
   cache.insert( std::pair<double,std::complex<double> >(agamma,epsilon) );
@@ -76,19 +111,53 @@ std::string ResStrengthsData::printSingle(double agamma, std::complex<double> ep
 
 
 
+// split spin tune grid into chunks, if there are less particles than threads.
+// non-uniform FFT is efficient for large chunks, so no more chunks than needed
 void ResStrengths::init()
 {
   if (queue.size() > 0)
     return;
+
+  grid = std::make_shared<const std::vector<double>>( missingGrid() );
+  unsigned int nParticles = config->nParticles();
+  std::size_t nThreads = threadPool.size();
+  numChunks = std::max<std::size_t>(1, std::min(grid->size(), (nThreads + nParticles - 1) / nParticles));
+  chunkSize = (grid->size() + numChunks - 1) / numChunks;
+  numChunks = (chunkSize==0) ? 1 : (grid->size() + chunkSize - 1) / chunkSize;
+  epsilons.assign(std::size_t(nParticles) * grid->size(), std::complex<double>(0,0));
   
   std::cout << "Estimate Resonance Strengths using "
 	    << config->numTurns() << " turns for "
-    	    << config->nParticles() << " particles:" << std::endl;
-  for (unsigned int i=0; i<config->nParticles(); i++) {
-    queue.emplace_back( ParticleResStrengths(i,config,lattice,orbit) );
+    	    << nParticles << " particles";
+  if (numChunks > 1)
+    std::cout << " (" << numChunks << " spin tune chunks each)";
+  std::cout << ":" << std::endl;
+
+  queue.reserve(nParticles * numChunks);
+  for (unsigned int i=0; i<nParticles; i++) {
+    auto samples = std::make_shared<ResStrengthsSamples>(numChunks);
+    for (std::size_t c=0; c<numChunks; c++) {
+      std::size_t first = c*chunkSize;
+      std::size_t n = std::min(chunkSize, grid->size()-first);
+      queue.emplace_back( ParticleResStrengths(i,config,lattice,orbit, samples, grid, first, n, epsilons.data() + i*grid->size() + first) );
+    }
   }
 }
 
+
+// res. strength of a particle: grid point from dense array,
+// refined spin tune (adaptive) interpolated by the task of the chunk containing agamma
+std::complex<double> ResStrengths::particleValue(unsigned int particle, double agamma) const
+{
+  std::size_t k = std::lower_bound(grid->begin(), grid->end(), agamma) - grid->begin();
+  if (k < grid->size() && (*grid)[k] == agamma)
+    return epsilons[particle*grid->size() + k];
+  if (k == 0 || k == grid->size())
+    throw std::runtime_error("Resonance Strength not known for requested spin tune");
+  return queue[particle*numChunks + (k-1)/chunkSize].interpolate(agamma);
+}
+
+
 std::complex<double> ResStrengths::calculate(double agamma)
 {
   std::stringstream msg;
@@ -96,17 +165,98 @@ std::complex<double> ResStrengths::calculate(double agamma)
   polematrix::debug(__PRETTY_FUNCTION__, msg.str());
   
   std::complex<double> epsilon (0,0);
-  for (auto &p : queue) {
-    epsilon += p[agamma];
+  for (unsigned int p=0; p<numParticles(); p++) {
+    if (errors.count(p) == 0)
+      epsilon += particleValue(p, agamma);
   }
-  epsilon /= numParticles();
+  epsilon /= numSuccessful();
   cacheIt(agamma,epsilon);
   return epsilon;
 }
 
 
+// average over successful particles for all agammas, parallel over ranges of agammas
+void ResStrengths::average(const std::vector<double> &agammas)
+{
+  if (numSuccessful() == 0)
+    return;
+  std::vector<unsigned int> particles;
+  for (unsigned int p=0; p<numParticles(); p++) {
+    if (errors.count(p) == 0)
+      particles.push_back(p);
+  }
+
+  std::vector<std::complex<double>> mean(agammas.size());
+  std::size_t range = (agammas.size() + threadPool.size() - 1) / threadPool.size();
+  std::vector<std::thread> threads;
+  for (std::size_t begin=0; begin<agammas.size(); begin+=range) {
+    std::size_t end = std::min(begin+range, agammas.size());
+    threads.emplace_back([&,begin,end]() {
+	for (std::size_t i=begin; i<end; i++) {
+	  std::complex<double> sum (0,0);
+	  for (unsigned int p : particles)
+	    sum += particleValue(p, agammas[i]);
+	  mean[i] = sum / double(particles.size());
+	}
+      });
+  }
+  for (std::thread& t : threads)
+    t.join();
+
+  for (std::size_t i=0; i<agammas.size(); i++)
+    cacheIt(agammas[i], mean[i]);
+}
+
+
+// res. strengths in spin tune range from persistent cache (see ResStrengthsCache).
+// cached spin tunes are matched to the grid with a tolerance (summed up steps).
+// without adaptive grid other cached spin tunes are not used (output only on grid)
+bool ResStrengths::loadCache()
+{
+  if (!diskCache)
+    diskCache.reset( new ResStrengthsCache(*config) );
+  if (!diskCache->enabled())
+    return false;
+
+  const double tolerance = 1e-9;
+  std::vector<double> g = agammaGrid(*config);
+  ResStrengthsCache::Data data = diskCache->load(config->agammaMin()-tolerance, config->agammaMax()+tolerance);
+  for (double agamma : g) {
+    auto it = data.lower_bound(agamma-tolerance);
+    if (it != data.end() && it->first <= agamma+tolerance) {
+      cacheIt(agamma, it->second);
+      data.erase(it);
+    }
+  }
+  if (config->adaptive())
+    cache.insert(data.begin(), data.end());
+
+  return missingGrid().empty();
+}
+
+
+// grid points from first to last spin tune not in cache
+std::vector<double> ResStrengths::missingGrid() const
+{
+  std::vector<double> g = agammaGrid(*config);
+  auto isMissing = [this](double agamma){return cache.count(agamma)==0;};
+  auto begin = std::find_if(g.begin(), g.end(), isMissing);
+  if (begin == g.end())
+    return std::vector<double>();
+  auto end = std::find_if(g.rbegin(), g.rend(), isMissing).base();
+  return std::vector<double>(begin, end);
+}
+
+
 void ResStrengths::start()
 {
+  if (!diskCache)
+    loadCache();
+  if (queue.empty() && missingGrid().empty()) {
+    std::cout << "* all resonance strengths found in cache." << std::endl;
+    return;
+  }
+
   // fill particle queue
   init();
 
@@ -125,15 +275,27 @@ void ResStrengths::start()
 
   // finished: average ResStrengths
   std::cout << printErrors();
-  for (double agamma=config->agammaMin(); agamma<=config->agammaMax(); agamma+=config->dagamma()) {
-    calculate(agamma);
+  if (config->adaptive()) { // all spin tunes of all particles
+    std::set<double> agammas(grid->begin(), grid->end());
+    for (auto &p : queue)
+      for (double agamma : p.spinTunes())
+	agammas.insert(agamma);
+    average( std::vector<double>(agammas.begin(), agammas.end()) );
   }
+  else {
+    average(*grid);
+  }
+  if (numSuccessful() == numParticles())
+    diskCache->store(cache);
   if (numSuccessful() > 0) {
     auto stop = std::chrono::high_resolution_clock::now();
     auto secs = std::chrono::duration_cast<std::chrono::seconds>(stop-start);
     std::cout << std::endl
 	      << "-----------------------------------------------------------------" << std::endl;
-    std::cout << "Resonance Strengths estimated via "<<numSuccessful()<< " particles in ";
+    std::cout << "Resonance Strengths estimated via "<<numSuccessful()<< " particles";
+    if (config->adaptive())
+      std::cout << " at " << cache.size() << " spin tunes";
+    std::cout << " in ";
     std::cout << secs.count() << " s = "<< int(secs.count()/60.+0.5) << " min." << std::endl;
     std::cout << "Thanks for using polematrix " << polemversion() << std::endl;
     std::cout << "-----------------------------------------------------------------" << std::endl;
@@ -169,7 +331,8 @@ void ResStrengths::print(string filename)
   info.add("and polematrix version", polemversion());
   info.add("Description", "strengths of depolarizing resonances (complex numbers)");
   info.add("turns used for res. strength calc.", config->numTurns());
-  info += lattice->info;
+  if (lattice) // not set, if all res. strengths are cached
+    info += lattice->info;
   s << info.out("#");
 
   // header
@@ -199,8 +362,10 @@ void ResStrengths::print(string filename)
 
 
 
-ParticleResStrengths::ParticleResStrengths(unsigned int id, const std::shared_ptr<Configuration> c,std::shared_ptr<const pal::AccLattice> l, std::shared_ptr<const pal::FunctionOfPos<pal::AccPair>> o)
-  : SingleParticleSimulation(id,c)
+ParticleResStrengths::ParticleResStrengths(unsigned int id, const std::shared_ptr<Configuration> c,std::shared_ptr<const pal::AccLattice> l, std::shared_ptr<const pal::FunctionOfPos<pal::AccPair>> o,
+					   std::shared_ptr<ResStrengthsSamples> s, std::shared_ptr<const std::vector<double>> g,
+					   std::size_t firstPoint, std::size_t nPoints, std::complex<double> *output)
+  : SingleParticleSimulation(id,c), samples(s), grid(g), first(firstPoint), n(nPoints), out(output), evaluated(0)
 {
   setModel(l,o);
 }
@@ -218,46 +383,165 @@ std::complex<double> ParticleResStrengths::calculate(double agamma)
   std::stringstream msg;
   msg << "calculate gamma*a=" << agamma;
   polematrix::debug(__PRETTY_FUNCTION__, msg.str());
-  
-  std::complex<double> epsilon (0,0);
 
-  for (unsigned int turn=0; turn<config->numTurns(); turn++) {
+  sampleFields();
+
+  std::complex<double> Px, Ps, Qx, Qs;
+  samples->elementSum.evaluate(agamma, Px, Ps);
+  samples->dipoleSum.evaluate(agamma, Qx, Qs);
+  std::complex<double> epsilon = fromSums(agamma, Px, Ps, Qx, Qs);
+  cacheIt(agamma,epsilon);
+  return epsilon;
+}
+
+
+// the fields do not depend on agamma: sample them once for all elements & turns.
+// for each element the res. strength is a sum of terms c*e^{i*agamma*theta}:
+// - dipole: epsilon = 1/2pi * omega * R/(i*agamma) * (e^{i*agamma*theta2}-e^{i*agamma*theta1})
+// - all others: epsilon = 1/2pi * e^{i*agamma*theta} *  omega * l
+// with field from Thomas-BMT equation:
+// omega = (1+agamma) * B_x - i * (1+a) * B_s
+// assume particle velocity parallel to s-axis, B is already normalized to rigidity (BR)_0 = p_0/e
+// closed orbit is periodic: contribution of turn t = contribution of turn 0 * exp(i*agamma*2pi*t)
+// the first task of a particle samples, the others wait for it.
+void ParticleResStrengths::sampleFields()
+{
+  std::lock_guard<std::mutex> lock(samples->mutex);
+  if (samples->ready)
+    return;
+
+  bool periodic = (config->trajectoryMode() == TrajectoryMode::closed_orbit);
+  unsigned int turns = periodic ? 1 : config->numTurns();
+  ResonanceSum &elementSum = samples->elementSum;
+  ResonanceSum &dipoleSum = samples->dipoleSum;
+
+  trajectory->init();
+
+  elementSum.clear();
+  dipoleSum.clear();
+  elementSum.reserve( turns * lattice->size() );
+  dipoleSum.reserve( 2 * turns * lattice->size(dipole) );
+
+  for (unsigned int turn=0; turn<turns; turn++) {
     for (AccLattice::const_iterator it=lattice->begin(); it!=lattice->end(); ++it) {
       double pos = it.pos() + turn*lattice->circumference();
-      //field from Thomas-BMT equation:
-      // omega = (1+agamma) * B_x - i * (1+a) * B_s
-      // assume particle velocity parallel to s-axis, B is already normalized to rigidity (BR)_0 = p_0/e
-      std::complex<double> omega = (1+agamma)*it.element()->B(trajectory->get(pos)).x - im * (1+config->a_gyro)*it.element()->B(trajectory->get(pos)).s;
-
-      // dipole
+      AccTriple B = it.element()->B(trajectory->get(pos));
       if (it.element()->type == dipole) {
 	double R = ((Dipole*)it.element())->R(); // bending radius
-	// calculate for dipole: epsilon = 1/2pi * omega * R/(i*agamma) * (e^{i*agamma*theta2}-e^{i*agamma*theta1})
-	epsilon += 1/(2*M_PI) * omega * R/(im*agamma) * (std::exp(im*agamma*(lattice->theta(it.end())+turn*2*M_PI)) - std::exp(im*agamma*(lattice->theta(it.begin())+turn*2*M_PI)));
+	dipoleSum.add( lattice->theta(it.end())+turn*2*M_PI, B.x*R, B.s*R );
+	dipoleSum.add( lattice->theta(it.begin())+turn*2*M_PI, -B.x*R, -B.s*R );
       }
       else {
-	// calculate for all others: epsilon = 1/2pi * e^{i*agamma*theta} *  omega * l
-	epsilon += 1/(2*M_PI) * std::exp(im*agamma*(lattice->theta(it.pos())+turn*2*M_PI)) * omega * it.element()->length;
+	elementSum.add( lattice->theta(it.pos())+turn*2*M_PI, B.x*it.element()->length, B.s*it.element()->length );
       }
     }//lattice
   }//turn
 
-  epsilon /= double(config->numTurns());
-  cacheIt(agamma,epsilon);
-  return epsilon;
+  trajectory->clear();
+  samples->periodic = periodic;
+  samples->ready = true;
+}
+
+
+// res. strength from sums over non-dipoles (Px,Ps) and dipoles (Qx,Qs) (see sampleFields())
+std::complex<double> ParticleResStrengths::fromSums(double agamma, const std::complex<double> &Px, const std::complex<double> &Ps,
+						    const std::complex<double> &Qx, const std::complex<double> &Qs) const
+{
+  std::complex<double> epsilon = resonanceStrength(agamma, config->a_gyro, samples->dipoleSum.size() > 0, Px, Ps, Qx, Qs);
+  if (samples->periodic)
+    epsilon *= turnSum(agamma, config->numTurns());
+  return epsilon / double(config->numTurns());
 }
 
 
 
+// evaluate grid points first...first+n-1 into dense output array
 void ParticleResStrengths::run()
 {
-  trajectory->init();
+  double localScale = 0.;
+  try {
+    sampleFields();
+    const ResonanceSum &elementSum = samples->elementSum;
+    const ResonanceSum &dipoleSum = samples->dipoleSum;
+
+    // evaluate agamma grid in blocks (progress output), non-uniform FFT in one block
+    const std::vector<double> &g = *grid;
+    const std::size_t block = config->nufft() ? n : 1024;
+    std::vector<std::complex<double>> Px, Ps, Qx, Qs;
+    for (std::size_t b=0; b<n; b+=block) {
+      unsigned int m = std::min(block, n-b);
+      for (auto v : {&Px, &Ps, &Qx, &Qs})
+	v->assign(m, std::complex<double>(0,0));
+      if (config->nufft()) {
+	elementSum.evaluateNufft(g[first+b], config->dagamma(), m, Px, Ps, config->nufftTolerance());
+	dipoleSum.evaluateNufft(g[first+b], config->dagamma(), m, Qx, Qs, config->nufftTolerance());
+      }
+      else {
+	elementSum.evaluate(g[first+b], config->dagamma(), m, Px, Ps);
+	dipoleSum.evaluate(g[first+b], config->dagamma(), m, Qx, Qs);
+      }
+      for (unsigned int k=0; k<m; k++) {
+	out[b+k] = fromSums(g[first+b+k], Px[k], Ps[k], Qx[k], Qs[k]);
+	localScale = std::max(localScale, std::abs(out[b+k]));
+      }
+      evaluated += m;
+    }
+  }
+  catch (std::exception &e) {
+    if (config->adaptive())
+      gridScale(localScale); // do not block other chunks of this particle
+    throw;
+  }
 
-  for (double agamma=config->agammaMin(); agamma<=config->agammaMax(); agamma+=config->dagamma()) {
-    calculate(agamma);
+  if (config->adaptive()) {
+    // intervals of this chunk incl. the one to the first grid point of the next chunk
+    for (std::size_t k=0; k<n; k++)
+      cacheIt( (*grid)[first+k], out[k] );
+    if (first+n < grid->size())
+      calculate( (*grid)[first+n] );
+    refine( gridScale(localScale) );
   }
-  
-  trajectory->clear();
+
+  samples.reset(); // last task of the particle frees the samples
+}
+
+
+// max. |epsilon| on grid points of all chunks of this particle. Waits for the other chunks.
+// no deadlock: chunks of a particle are queued consecutively and there are not more chunks than threads
+double ParticleResStrengths::gridScale(double localScale)
+{
+  std::unique_lock<std::mutex> lock(samples->mutex);
+  samples->scale = std::max(samples->scale, localScale);
+  samples->arrived++;
+  samples->allArrived.notify_all();
+  samples->allArrived.wait(lock, [this]{return samples->arrived >= samples->tasks;});
+  return samples->scale;
 }
 
 
+
+// adaptive spin tune grid: bisect intervals between cached spin tunes, where the res. strength
+// at the midpoint deviates from linear interpolation by more than tolerance * max. |epsilon|
+// on the grid. so peaks and steep regions are resolved down to adaptiveMinStep()
+void ParticleResStrengths::refine(double scale)
+{
+  std::vector<std::pair<double,double>> intervals;
+  for (auto it=cache.begin(); it!=cache.end() && std::next(it)!=cache.end(); ++it)
+    intervals.emplace_back(it->first, std::next(it)->first);
+
+  const double minStep = config->adaptiveMinStep() * (1-1e-9); // rounding of bisected steps
+  while (!intervals.empty()) {
+    auto i = intervals.back();
+    intervals.pop_back();
+    double m = 0.5*(i.first + i.second);
+    if (m - i.first < minStep)
+      continue;
+    std::complex<double> linear = 0.5*(cache[i.first] + cache[i.second]);
+    std::complex<double> epsilon = calculate(m);
+    evaluated++;
+    if (std::abs(epsilon - linear) > config->adaptiveTolerance() * scale) {
+      intervals.emplace_back(i.first, m);
+      intervals.emplace_back(m, i.second);
+    }
+  }
+}
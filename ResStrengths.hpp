@@ -28,12 +28,18 @@
 
 #include <map>
 #include <complex>
+#include <vector>
 #include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
 #include <libpalattice/AccLattice.hpp>
 #include <libpalattice/FunctionOfPos.hpp>
 #include <libpalattice/Metadata.hpp>
 #include "Simulation.hpp"
 #include "Trajectory.hpp"
+#include "ResonanceSums.hpp"
+#include "ResStrengthsCache.hpp"
 #include "version.hpp"
 
 
@@ -50,6 +56,8 @@ protected:
 public:
   ResStrengthsData() : im(std::complex<double> (0,1)) {}
   std::complex<double> operator[](double agamma);        // get res. strength from cache
+  std::complex<double> interpolate(double agamma) const; // linear interpolation of cache
+  std::vector<double> spinTunes() const;                 // all cached spin tunes
 
   std::string printSingle(double agamma, std::complex<double> epsilon) const; // formated output of entry
   std::string printSingle(const std::pair<double,std::complex<double> >& it) const {return printSingle(it.first,it.second);}
@@ -58,28 +66,72 @@ public:
 
 
 
-// Resonance Strengths for a single particle
+// Resonance Strengths for a single particle and a chunk of the spin tune grid
+
+// field samples of a particle, shared by the tasks of all its spin tune chunks
+struct ResStrengthsSamples {
+  std::mutex mutex;
+  bool ready;
+  ResonanceSum elementSum;  // field samples of all elements except dipoles
+  ResonanceSum dipoleSum;   // field samples of dipoles (at entrance & exit)
+  bool periodic;            // samples of one turn only (closed orbit)
+
+  // adaptive grid: max. |epsilon| on grid points of all chunks
+  const unsigned int tasks;
+  unsigned int arrived;
+  double scale;
+  std::condition_variable allArrived;
+
+  ResStrengthsSamples(unsigned int nTasks) : ready(false), periodic(false), tasks(nTasks), arrived(0), scale(0.) {}
+};
 
 class ParticleResStrengths : public SingleParticleSimulation, public ResStrengthsData {
 protected:
+  std::shared_ptr<ResStrengthsSamples> samples;
+  std::shared_ptr<const std::vector<double>> grid; // spin tune grid (agammaGrid())
+  const std::size_t first;   // first grid point of this task
+  const std::size_t n;       // number of grid points of this task
+  std::complex<double> *out; // res. strengths of grid points first...first+n-1 (dense array of ResStrengths)
+  std::size_t evaluated;
+
   std::complex<double> calculate(double agamma);    // calculate res. strength freq. omega=agamma
+  void sampleFields();       // samples are shared: only called once per particle
+  double gridScale(double localScale);
+  void refine(double scale);
+  std::complex<double> fromSums(double agamma, const std::complex<double> &Px, const std::complex<double> &Ps,
+				const std::complex<double> &Qx, const std::complex<double> &Qs) const;
   
 public:
-  ParticleResStrengths(unsigned int id, const std::shared_ptr<Configuration> c,std::shared_ptr<const pal::AccLattice> l, std::shared_ptr<const pal::FunctionOfPos<pal::AccPair>> o);
+  ParticleResStrengths(unsigned int id, const std::shared_ptr<Configuration> c,std::shared_ptr<const pal::AccLattice> l, std::shared_ptr<const pal::FunctionOfPos<pal::AccPair>> o,
+		       std::shared_ptr<ResStrengthsSamples> s, std::shared_ptr<const std::vector<double>> g,
+		       std::size_t firstPoint, std::size_t nPoints, std::complex<double> *output);
   ParticleResStrengths(const ParticleResStrengths& other) = delete;
   ParticleResStrengths(ParticleResStrengths&& other) = default;
   
   void run();
   void runSingle();
+  static void simToolTurns(const Configuration& c, const pal::FunctionOfPos<pal::AccPair>&, unsigned int &first, unsigned int &last)
+  {first = 1; last = c.numTurns();}
 
-  double getProgress() const {return (double)cache.size() / config->outSteps_resStrengths();}
+  double getProgress() const {return (n==0) ? 1. : std::min(1., (double)evaluated / n);}
 };
 
 
 
+// tasks: all particles x chunks of the spin tune grid, so all threads are used also for few particles.
+// results of the grid points are written to a dense array (particle-major) and averaged in parallel
 class ResStrengths : public Simulation<ParticleResStrengths>, public ResStrengthsData {
 protected:
+  std::shared_ptr<const std::vector<double>> grid;
+  std::vector<std::complex<double>> epsilons; // res. strengths of all particles at grid points
+  std::size_t chunkSize;                      // grid points per task
+  std::size_t numChunks;                      // tasks per particle
+  std::unique_ptr<ResStrengthsCache> diskCache;
+
   std::complex<double> calculate(double agamma);
+  std::complex<double> particleValue(unsigned int particle, double agamma) const;
+  void average(const std::vector<double> &agammas);
+  std::vector<double> missingGrid() const;  // part of agammaGrid() to be calculated (not cached)
   void init();
   
 public:
@@ -89,6 +141,7 @@ public:
   ResStrengths(const std::shared_ptr<Configuration> c, unsigned int nThreads=std::thread::hardware_concurrency()) : Simulation(c,nThreads) {}
   ResStrengths(const ResStrengths& o) = delete;
 
+  bool loadCache();                              // load from disk cache, true if all spin tunes cached (no model needed)
   void start();                                  // calculate & print all res. strengths according to config
   std::string getSingle(double agamma);          // calculate & print single resonance strength
 
@@ -97,5 +150,10 @@ public:
 };
 
 
+
+// spin tune grid agammaMin...agammaMax as used for res. strength output
+std::vector<double> agammaGrid(const Configuration &config);
+
+
 #endif
 /*__POLEMATRIX__RESSTRENGTHS_HPP_*/
@@ -0,0 +1,132 @@
+/* ResStrengthsCache Class
+ * persistent cache of resonance strengths (see ResStrengths).
+ * The averaged resonance strengths are stored in a file per model, which is named by
+ * a hash of the lattice file contents (incl. included files) and all settings influencing the resonance strengths
+ * except the spin tune grid. Following runs only calculate spin tunes missing in this file.
+ * Concurrent runs merge their results into the file (exclusive file lock).
+ *
+ * Copyright (C) 2017 Jan Felix Schmidt <janschmidt@mailbox.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sstream>
+#include <iomanip>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include "ResStrengthsCache.hpp"
+#include "SimToolCache.hpp"
+#include "debug.hpp"
+
+
+ResStrengthsCache::ResStrengthsCache(Configuration& c) : config(c)
+{
+  if (!enabled())
+    return;
+
+  std::stringstream k;
+  k << "resstrengths_" << std::hex << std::setw(16) << std::setfill('0')
+    << fnv1a(settings(), fnv1a(latticeContent(config.getSimToolInstance().inFile())));
+  key = k.str();
+  polematrix::debug(__PRETTY_FUNCTION__, "key " + key);
+}
+
+
+// settings of the SimTool model (see SimToolCache::settings()) and of the particle trajectories
+std::string ResStrengthsCache::settings() const
+{
+  std::stringstream s;
+  s << std::setprecision(17);
+  s << config.getSimToolInstance().tool_string() << ";E0=" << config.E0() << ";a=" << config.a_gyro
+    << ";turns=" << config.numTurns() << ";trajectory=" << config.trajectoryModeString();
+
+  if (config.trajectoryMode() != TrajectoryMode::closed_orbit)
+    s << ";nParticles=" << config.nParticles();
+  if (config.trajectoryMode() == TrajectoryMode::oscillation) {
+    s << ";emittance=" << config.emittance().x << "," << config.emittance().z
+      << ";tune=" << config.tune().x << "," << config.tune().z << ";seed=" << config.seed();
+    if (config.sampling() != Sampling::random || config.antithetic())
+      s << ";sampling=" << config.samplingString() << ",antithetic=" << config.antithetic();
+  }
+  else if (config.trajectoryMode() == TrajectoryMode::simtool) {
+    s << ";gamma=" << config.gammaModeString() << ";t_start=" << config.t_start() << ",t_stop=" << config.t_stop()
+      << ",dE=" << config.dE() << ",Emax=" << config.Emax();
+    if (config.simToolRamp())
+      s << ";ramp:steps=" << config.simToolRampSteps();
+  }
+  return s.str();
+}
+
+
+// one line per spin tune: agamma real(epsilon) imag(epsilon)
+ResStrengthsCache::Data ResStrengthsCache::read() const
+{
+  Data data;
+  std::ifstream in( file().string() );
+  double agamma, re, im;
+  while (in >> agamma >> re >> im)
+    data.emplace(agamma, std::complex<double>(re,im));
+  return data;
+}
+
+
+ResStrengthsCache::Data ResStrengthsCache::load(double agammaMin, double agammaMax) const
+{
+  Data data;
+  if (!enabled())
+    return data;
+  Data all = read();
+  data.insert( all.lower_bound(agammaMin), all.upper_bound(agammaMax) );
+  if (!data.empty())
+    std::cout << "* " << data.size() << " resonance strengths loaded from cache " << file().string() << std::endl;
+  return data;
+}
+
+
+// read-merge-write while holding an exclusive lock on <file>.lock.
+// the file is replaced by rename, so readers without lock never see incomplete files.
+void ResStrengthsCache::store(const Data& data) const
+{
+  if (!enabled() || data.empty())
+    return;
+  fs::create_directories(config.resStrengthsCache());
+
+  std::string lockFile = file().string() + ".lock";
+  int fd = open(lockFile.c_str(), O_RDWR | O_CREAT, 0644);
+  if (fd < 0 || flock(fd, LOCK_EX) != 0) {
+    if (fd >= 0)
+      close(fd);
+    throw std::runtime_error("ResStrengthsCache: Cannot lock " + lockFile);
+  }
+
+  Data merged = read();
+  merged.insert(data.begin(), data.end()); // existing entries are kept
+
+  std::stringstream tmpName;
+  tmpName << file().string() << ".tmp" << getpid();
+  std::ofstream out(tmpName.str());
+  out << std::setprecision(17);
+  for (auto& it : merged)
+    out << it.first << " " << it.second.real() << " " << it.second.imag() << std::endl;
+  out.close();
+
+  boost::system::error_code ec;
+  fs::rename(tmpName.str(), file(), ec);
+  flock(fd, LOCK_UN);
+  close(fd);
+  if (ec)
+    throw std::runtime_error("ResStrengthsCache: Cannot write " + file().string() + ": " + ec.message());
+  std::cout << "* resonance strengths stored in cache " << file().string() << std::endl;
+}
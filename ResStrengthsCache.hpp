@@ -0,0 +1,57 @@
+/* ResStrengthsCache Class
+ * persistent cache of resonance strengths (see ResStrengths).
+ * The averaged resonance strengths are stored in a file per model, which is named by
+ * a hash of the lattice file contents (incl. included files) and all settings influencing the resonance strengths
+ * except the spin tune grid. Following runs only calculate spin tunes missing in this file.
+ * Concurrent runs merge their results into the file (exclusive file lock).
+ *
+ * Copyright (C) 2017 Jan Felix Schmidt <janschmidt@mailbox.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __POLEMATRIX__RESSTRENGTHSCACHE_HPP_
+#define __POLEMATRIX__RESSTRENGTHSCACHE_HPP_
+
+#include <map>
+#include <complex>
+#include <string>
+#include "Configuration.hpp"
+
+
+class ResStrengthsCache
+{
+public:
+  typedef std::map<double,std::complex<double> > Data;
+
+protected:
+  Configuration& config;
+  std::string key;          // hash of lattice & settings
+
+  std::string settings() const;  // all settings, which influence the res. strengths (except spin tune grid)
+  Data read() const;             // whole cache file (empty if not existing)
+
+public:
+  ResStrengthsCache(Configuration& c);
+
+  bool enabled() const {return !config.resStrengthsCache().empty();}
+  fs::path file() const {return config.resStrengthsCache()/(key+".dat");}
+
+  Data load(double agammaMin, double agammaMax) const; // cached res. strengths in spin tune range
+  void store(const Data& data) const;                  // merge data into cache file
+};
+
+
+#endif
+// __POLEMATRIX__RESSTRENGTHSCACHE_HPP_
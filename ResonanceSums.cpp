@@ -0,0 +1,273 @@
+/* ResonanceSums
+ * Fourier-type sums used for the calculation of resonance strengths (see ResStrengths)
+ *
+ * Copyright (C) 2017 Jan Felix Schmidt <janschmidt@mailbox.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cmath>
+#include <algorithm>
+#include <gsl/gsl_fft_complex.h>
+#include "ResonanceSums.hpp"
+
+const unsigned int exactEvery = 64; // grid evaluation: exact exp() after this number of rotations
+
+
+// = exp(i*pi*agamma*(n-1)) * sin(n*pi*agamma)/sin(pi*agamma).
+// the ratio of sines is evaluated relative to the nearest integer k of agamma:
+// sin(n*pi*agamma)/sin(pi*agamma) = (-1)^(k*(n-1)) * sin(n*d)/sin(d),  d = pi*(agamma-k)
+std::complex<double> turnSum(double agamma, unsigned int nTurns)
+{
+  if (nTurns == 0)
+    return std::complex<double>(0,0);
+
+  double k = std::round(agamma);
+  double d = M_PI * (agamma - k);
+  double ratio;
+  if (d == 0.)
+    ratio = nTurns;
+  else
+    ratio = std::sin(nTurns*d) / std::sin(d);
+  if (std::fmod(std::fabs(k),2.) == 1. && (nTurns-1)%2 == 1)
+    ratio = -ratio;
+
+  return std::polar(ratio, M_PI*agamma*(nTurns-1.));
+}
+
+
+
+// epsilon = 1/2pi * ((1+agamma)*X - i*(1+a)*S), dipole contributions divided by i*agamma
+std::complex<double> resonanceStrength(double agamma, double a_gyro, bool dipoles,
+				       const std::complex<double> &Px, const std::complex<double> &Ps,
+				       const std::complex<double> &Qx, const std::complex<double> &Qs)
+{
+  const std::complex<double> im(0,1);
+  std::complex<double> x = Px;
+  std::complex<double> s = Ps;
+  if (dipoles) {
+    x += Qx/(im*agamma);
+    s += Qs/(im*agamma);
+  }
+  return 1/(2*M_PI) * ((1+agamma)*x - im*(1+a_gyro)*s);
+}
+
+
+
+void ResonanceSum::clear()
+{
+  std::vector<double>().swap(theta);
+  std::vector<double>().swap(cx);
+  std::vector<double>().swap(cs);
+}
+
+
+void ResonanceSum::evaluate(double agamma, std::complex<double> &x, std::complex<double> &s) const
+{
+  double xr=0., xi=0., sr=0., si=0.;
+  for (std::size_t j=0; j<theta.size(); j++) {
+    double c = std::cos(agamma*theta[j]);
+    double sn = std::sin(agamma*theta[j]);
+    xr += cx[j]*c;
+    xi += cx[j]*sn;
+    sr += cs[j]*c;
+    si += cs[j]*sn;
+  }
+  x = std::complex<double>(xr,xi);
+  s = std::complex<double>(sr,si);
+}
+
+
+// exp(i*agamma_k*theta_j) is rotated from grid point k to k+1 by exp(i*dagamma*theta_j).
+// inner loop over j on separate real/imaginary arrays without dependencies (vectorizable)
+void ResonanceSum::evaluate(double agamma0, double dagamma, unsigned int n,
+			    std::vector<std::complex<double>> &x, std::vector<std::complex<double>> &s) const
+{
+  std::size_t m = theta.size();
+  x.resize(n, std::complex<double>(0,0));
+  s.resize(n, std::complex<double>(0,0));
+  std::vector<double> zr(m), zi(m), wr(m), wi(m);
+  for (std::size_t j=0; j<m; j++) {
+    wr[j] = std::cos(dagamma*theta[j]);
+    wi[j] = std::sin(dagamma*theta[j]);
+  }
+
+  for (unsigned int k=0; k<n; k++) {
+    if (k % exactEvery == 0) {
+      double agamma = agamma0 + k*dagamma;
+      for (std::size_t j=0; j<m; j++) {
+	zr[j] = std::cos(agamma*theta[j]);
+	zi[j] = std::sin(agamma*theta[j]);
+      }
+    }
+    double xr=0., xi=0., sr=0., si=0.;
+    for (std::size_t j=0; j<m; j++) {
+      xr += cx[j]*zr[j];
+      xi += cx[j]*zi[j];
+      sr += cs[j]*zr[j];
+      si += cs[j]*zi[j];
+      double r = zr[j]*wr[j] - zi[j]*wi[j];
+      zi[j] = zr[j]*wi[j] + zi[j]*wr[j];
+      zr[j] = r;
+    }
+    x[k] += std::complex<double>(xr,xi);
+    s[k] += std::complex<double>(sr,si);
+  }
+}
+
+
+
+// smallest number >= n with prime factors 2,3,5 only (fast for gsl mixed-radix fft)
+unsigned int fftSize(unsigned int n)
+{
+  for (;; n++) {
+    unsigned int m = n;
+    for (unsigned int p : {2u,3u,5u}) {
+      while (m % p == 0)
+	m /= p;
+    }
+    if (m == 1)
+      return n;
+  }
+}
+
+
+// type-1 non-uniform FFT with gaussian gridding:
+// L. Greengard, J.-Y. Lee, "Accelerating the Nonuniform Fast Fourier Transform", SIAM Review 46 (2004)
+//
+// sum_j c_j e^{i*(agamma0 + k*dagamma)*theta_j} = sum_j c'_j e^{i*k'*x_j}
+// with x_j = dagamma*theta_j mod 2pi, modes k' = k - M/2 in [-M/2,M/2) and c'_j = c_j e^{i*(agamma0+M/2*dagamma)*theta_j}.
+// c'_j are spread to an oversampled grid (Mr points) by a periodic gaussian of width tau,
+// which is deconvolved after the FFT.
+void ResonanceSum::evaluateNufft(double agamma0, double dagamma, unsigned int n,
+				 std::vector<std::complex<double>> &x, std::vector<std::complex<double>> &s, double tolerance) const
+{
+  x.resize(n, std::complex<double>(0,0));
+  s.resize(n, std::complex<double>(0,0));
+  if (n == 0 || theta.empty())
+    return;
+
+  // spreading width (grid points to each side) for requested accuracy (Greengard & Lee),
+  // oversampling R = Mr/M >= 2. number of modes M >= n, grid must be wider than spreading
+  auto spreading = [tolerance](double R) {
+    return std::max(2u, (unsigned int)std::ceil( -std::log(tolerance) / (M_PI*(R-1)/(R-0.5)) ));
+  };
+  unsigned int M = std::max(n + n%2, 2*spreading(2.));
+  unsigned int shift = M/2;
+  unsigned int Mr = fftSize(2*M);
+  double R = double(Mr)/M;
+  unsigned int Msp = spreading(R);
+  double tau = M_PI*Msp / (double(M)*M*R*(R-0.5));
+  double h = 2*M_PI/Mr;
+
+  // gaussian exp(-(l*h-d)^2/4tau) = E1 * E2^l * E3[l],  E1=exp(-d^2/4tau), E2=exp(l*h*d/2tau), E3[l]=exp(-(l*h)^2/4tau)
+  std::vector<double> E3(Msp+1);
+  for (unsigned int l=0; l<=Msp; l++)
+    E3[l] = std::exp( -std::pow(l*h,2)/(4*tau) );
+
+  // grid of x & s as packed complex arrays (re,im,re,im,...)
+  std::vector<double> gx(2*Mr, 0.), gs(2*Mr, 0.);
+  auto spread = [&](long m, double w, double xr, double xi, double sr, double si) {
+    std::size_t i = 2 * ( ((m % long(Mr)) + Mr) % Mr );
+    gx[i] += w*xr;
+    gx[i+1] += w*xi;
+    gs[i] += w*sr;
+    gs[i+1] += w*si;
+  };
+  for (std::size_t j=0; j<theta.size(); j++) {
+    double xj = std::fmod(dagamma*theta[j], 2*M_PI);
+    if (xj < 0.)
+      xj += 2*M_PI;
+    double phase = (agamma0 + shift*dagamma) * theta[j];
+    double cr = std::cos(phase);
+    double ci = std::sin(phase);
+
+    long m0 = std::floor(xj/h);
+    double d = xj - m0*h;
+    double E1 = std::exp( -d*d/(4*tau) );
+    double E2 = std::exp( h*d/(2*tau) );
+    double E2l = 1.;
+    for (unsigned int l=0; l<=Msp; l++) {        // grid points m0 ... m0+Msp
+      spread(m0+l, E1*E2l*E3[l], cx[j]*cr, cx[j]*ci, cs[j]*cr, cs[j]*ci);
+      E2l *= E2;
+    }
+    E2l = 1.;
+    for (unsigned int l=1; l<Msp; l++) {         // grid points m0-1 ... m0-Msp+1
+      E2l /= E2;
+      spread(m0-long(l), E1*E2l*E3[l], cx[j]*cr, cx[j]*ci, cs[j]*cr, cs[j]*ci);
+    }
+  }
+
+  // sum_m g_m e^{+2pi*i*k*m/Mr}
+  gsl_fft_complex_wavetable *wavetable = gsl_fft_complex_wavetable_alloc(Mr);
+  gsl_fft_complex_workspace *workspace = gsl_fft_complex_workspace_alloc(Mr);
+  gsl_fft_complex_backward(gx.data(), 1, Mr, wavetable, workspace);
+  gsl_fft_complex_backward(gs.data(), 1, Mr, wavetable, workspace);
+  gsl_fft_complex_workspace_free(workspace);
+  gsl_fft_complex_wavetable_free(wavetable);
+
+  // deconvolution
+  for (unsigned int k=0; k<n; k++) {
+    long kk = long(k) - shift;
+    std::size_t i = 2 * ( (kk + Mr) % Mr );
+    double f = std::sqrt(M_PI/tau) * std::exp(kk*kk*tau) / Mr;
+    x[k] += f * std::complex<double>(gx[i], gx[i+1]);
+    s[k] += f * std::complex<double>(gs[i], gs[i+1]);
+  }
+}
+
+
+
+// buffer size: evaluation cost per sample should not be dominated by per-block cost (FFT of grid size)
+void ResonanceSumGrid::init(double a0, double da, unsigned int nPoints, double tolerance)
+{
+  agamma0 = a0;
+  dagamma = da;
+  n = nPoints;
+  nufftTolerance = tolerance;
+  bufferSize = std::max<std::size_t>(8192, 4*std::size_t(n));
+  elementBuffer.clear();
+  dipoleBuffer.clear();
+  if (n > 0)
+    elementBuffer.reserve(bufferSize);
+  for (auto v : {&Px, &Ps, &Qx, &Qs})
+    v->assign(n, std::complex<double>(0,0));
+  dipoles = false;
+}
+
+
+void ResonanceSumGrid::flush(ResonanceSum &buffer, std::vector<std::complex<double>> &x, std::vector<std::complex<double>> &s)
+{
+  if (buffer.size() == 0)
+    return;
+  if (nufftTolerance > 0.)
+    buffer.evaluateNufft(agamma0, dagamma, n, x, s, nufftTolerance);
+  else
+    buffer.evaluate(agamma0, dagamma, n, x, s);
+  buffer.clear();
+  buffer.reserve(bufferSize);
+}
+
+
+void ResonanceSumGrid::flush()
+{
+  flush(elementBuffer, Px, Ps);
+  flush(dipoleBuffer, Qx, Qs);
+}
+
+
+std::complex<double> ResonanceSumGrid::epsilon(unsigned int k, double a_gyro) const
+{
+  return resonanceStrength(agamma0 + k*dagamma, a_gyro, dipoles, Px[k], Ps[k], Qx[k], Qs[k]);
+}
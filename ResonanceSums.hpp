@@ -0,0 +1,107 @@
+/* ResonanceSums
+ * Fourier-type sums used for the calculation of resonance strengths (see ResStrengths)
+ *
+ * Copyright (C) 2017 Jan Felix Schmidt <janschmidt@mailbox.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __POLEMATRIX__RESONANCESUMS_HPP_
+#define __POLEMATRIX__RESONANCESUMS_HPP_
+
+#include <complex>
+#include <vector>
+
+
+// sum_{turn=0}^{nTurns-1} exp(i*agamma*2pi*turn)
+// (geometric series, exact also at & near integer agamma)
+std::complex<double> turnSum(double agamma, unsigned int nTurns);
+
+// res. strength (not normalized to number of turns) from sums over non-dipoles (Px,Ps)
+// and dipoles (Qx,Qs) with field samples c*e^{i*agamma*theta} as described in ParticleResStrengths::sampleFields()
+std::complex<double> resonanceStrength(double agamma, double a_gyro, bool dipoles,
+				       const std::complex<double> &Px, const std::complex<double> &Ps,
+				       const std::complex<double> &Qx, const std::complex<double> &Qs);
+
+
+
+// sums X(agamma) = sum_j cx_j * exp(i*agamma*theta_j) and S(agamma) = sum_j cs_j * exp(i*agamma*theta_j)
+// with real coefficients cx, cs at the same angles theta.
+// stored as contiguous arrays, evaluated for single agamma or a uniform agamma grid
+class ResonanceSum
+{
+protected:
+  std::vector<double> theta;
+  std::vector<double> cx;
+  std::vector<double> cs;
+
+public:
+  void add(double t, double x, double s) {theta.push_back(t); cx.push_back(x); cs.push_back(s);}
+  void reserve(std::size_t n) {theta.reserve(n); cx.reserve(n); cs.reserve(n);}
+  void clear();
+  std::size_t size() const {return theta.size();}
+
+  void evaluate(double agamma, std::complex<double> &x, std::complex<double> &s) const;
+  // agamma = agamma0 + k*dagamma for k=0..n-1, results are added to x[k] and s[k]
+  void evaluate(double agamma0, double dagamma, unsigned int n,
+		std::vector<std::complex<double>> &x, std::vector<std::complex<double>> &s) const;
+  // same grid via non-uniform FFT, error relative to sum_j |c_j| approx. tolerance
+  void evaluateNufft(double agamma0, double dagamma, unsigned int n,
+		     std::vector<std::complex<double>> &x, std::vector<std::complex<double>> &s, double tolerance) const;
+};
+
+
+
+// sums for res. strengths on a uniform agamma grid, accumulated from a stream of field samples
+// (e.g. during spin tracking). Samples are buffered and evaluated blockwise, so memory is bounded.
+class ResonanceSumGrid
+{
+protected:
+  double agamma0;
+  double dagamma;
+  unsigned int n;
+  double nufftTolerance;     // evaluation via non-uniform FFT, 0: grid recurrence
+  std::size_t bufferSize;
+  ResonanceSum elementBuffer;
+  ResonanceSum dipoleBuffer;
+  std::vector<std::complex<double>> Px, Ps, Qx, Qs;
+  bool dipoles;
+
+  void flush(ResonanceSum &buffer, std::vector<std::complex<double>> &x, std::vector<std::complex<double>> &s);
+
+public:
+  ResonanceSumGrid() : agamma0(0.), dagamma(0.), n(0), nufftTolerance(0.), bufferSize(0), dipoles(false) {}
+
+  void init(double agamma0, double dagamma, unsigned int n, double nufftTolerance=0.);
+  void addElement(double theta, double x, double s) {
+    elementBuffer.add(theta, x, s);
+    if (elementBuffer.size() >= bufferSize)
+      flush(elementBuffer, Px, Ps);
+  }
+  void addDipole(double theta, double x, double s) {
+    dipoles = true;
+    dipoleBuffer.add(theta, x, s);
+    if (dipoleBuffer.size() >= bufferSize)
+      flush(dipoleBuffer, Qx, Qs);
+  }
+  void flush();                // evaluate all buffered samples
+
+  unsigned int size() const {return n;}
+  // res. strength at agamma0 + k*dagamma (flush() first), not normalized to number of turns
+  std::complex<double> epsilon(unsigned int k, double a_gyro) const;
+};
+
+
+#endif
+// __POLEMATRIX__RESONANCESUMS_HPP_
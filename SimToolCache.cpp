@@ -0,0 +1,216 @@
+/* SimToolCache Class
+ * persistent cache of SimTool (Elegant/MadX) output files.
+ * Output of an online SimTool run is copied to a cache directory, which is named by
+ * a hash of the lattice file contents (incl. included files) and all settings passed to the SimTool.
+ * Following runs with identical lattice & settings import these files in offline mode.
+ *
+ * Copyright (C) 2017 Jan Felix Schmidt <janschmidt@mailbox.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sstream>
+#include <iomanip>
+#include <regex>
+#include <set>
+#include <unistd.h>
+#include "SimToolCache.hpp"
+#include "debug.hpp"
+
+const std::string indexFileName = "simtool.cache"; // written to each cache entry, contains name of offline file
+
+
+std::uint64_t fnv1a(const std::string &data, std::uint64_t hash)
+{
+  for (unsigned char c : data) {
+    hash ^= c;
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+
+// is line an include statement? included: file name (relative to including file, if it exists there)
+static bool includedFile(const fs::path &file, const std::string &line, fs::path &included)
+{
+  static const std::regex includeRegex("^\\s*#include:\\s*[\"']?([^\"'\\s]+)"
+				       "|\\bcall\\s*,?\\s*file\\s*=\\s*[\"']?([^\"';,\\s]+)",
+				       std::regex::icase);
+  std::smatch m;
+  if (!std::regex_search(line, m, includeRegex))
+    return false;
+  included = m[1].matched ? m[1].str() : m[2].str();
+  if (included.is_relative() && fs::exists(file.parent_path()/included))
+    included = file.parent_path()/included;
+  return true;
+}
+
+// missing included files are part of the hash by name only (SimTool will fail anyway)
+static std::string latticeContent(const fs::path &file, std::set<fs::path> &visited)
+{
+  if (!visited.insert(file).second)
+    return "";
+  std::ifstream in(file.string(), std::ios::binary);
+  if (!in.is_open())
+    return "missing:" + file.string();
+  std::stringstream s;
+  s << in.rdbuf();
+  std::string result = s.str();
+
+  std::string line;
+  while (std::getline(s, line)) {
+    fs::path included;
+    if (!includedFile(file, line, included))
+      continue;
+    result += "\n" + included.string() + "\n" + latticeContent(included, visited);
+  }
+  return result;
+}
+
+std::string latticeContent(const fs::path &file)
+{
+  if (!fs::exists(file))
+    throw std::runtime_error("Cannot open lattice file " + file.string());
+  std::set<fs::path> visited;
+  return latticeContent(file, visited);
+}
+
+
+SimToolCache::SimToolCache(Configuration& c) : config(c)
+{
+  if (!enabled())
+    return;
+
+  std::stringstream k;
+  k << std::hex << std::setw(16) << std::setfill('0')
+    << fnv1a(settings(), fnv1a(latticeContent(config.getSimToolInstance().inFile())));
+  key = k.str();
+  polematrix::debug(__PRETTY_FUNCTION__, "key " + key);
+}
+
+
+bool SimToolCache::enabled() const
+{
+  return !config.simToolCache().empty() && config.getSimToolInstance().mode == pal::online;
+}
+
+
+// all settings written to SimToolInstance by Configuration::updateSimToolSettings() and set_nParticles().
+// with <chunks> the particle tracking is not done by this SimToolInstance (see SimToolStore)
+std::string SimToolCache::settings() const
+{
+  std::stringstream s;
+  s << std::setprecision(17);
+  s << config.getSimToolInstance().tool_string() << ";E0=" << config.E0();
+
+  if (config.simToolTracking() && config.simToolChunks() == 1) {
+    s << ";duration=" << config.duration() << ";nParticles=" << config.nParticles();
+  }
+
+  bool ramp = (config.gammaMode() == GammaMode::simtool
+	       || config.gammaMode() == GammaMode::simtool_no_interpolation
+	       || config.trajectoryMode() == TrajectoryMode::simtool);
+  if (ramp && config.simToolChunks() == 1 && config.simToolRamp() && config.getSimToolInstance().tool == pal::elegant) {
+    s << ";ramp:t_start=" << config.t_start() << ",t_stop=" << config.t_stop()
+      << ",steps=" << config.simToolRampSteps() << ",dE=" << config.dE() << ",Emax=" << config.Emax();
+  }
+  return s.str();
+}
+
+
+fs::path SimToolCache::offlineFile(const fs::path &dir) const
+{
+  std::ifstream index( (dir/indexFileName).string() );
+  std::string file;
+  if (!index.is_open() || !(index >> file))
+    return dir/indexFileName; // not a complete cache entry
+  return dir/file;
+}
+
+
+void SimToolCache::load()
+{
+  std::cout << "* import " << config.getSimToolInstance().tool_string() << " output from cache "
+	    << entry().string() << std::endl;
+  config.set_simToolOffline( offlineFile(entry()).string() );
+}
+
+
+// copy all output files of the SimTool run to a temporary directory, which is renamed to the cache entry.
+// so concurrent runs never see incomplete entries.
+void SimToolCache::store()
+{
+  auto& palattice = config.getSimToolInstance();
+  fs::path twiss = palattice.twiss(); // all output files start with same name as twiss file
+  fs::path dir = twiss.parent_path();
+  if (dir.empty())
+    dir = ".";
+  std::string prefix = twiss.stem().string() + ".";
+
+  std::string offline;
+  if (palattice.tool == pal::elegant)
+    offline = twiss.stem().string() + ".param";
+  else
+    offline = twiss.filename().string();
+
+  std::stringstream tmpName;
+  tmpName << key << ".tmp" << getpid();
+  fs::path tmp = config.simToolCache()/tmpName.str();
+  fs::create_directories(tmp);
+
+  for (fs::directory_iterator it(dir); it != fs::directory_iterator(); ++it) {
+    if ( fs::is_regular_file(it->path()) && it->path().filename().string().compare(0, prefix.size(), prefix) == 0 )
+      fs::copy_file(it->path(), tmp/it->path().filename());
+  }
+  std::ofstream index( (tmp/indexFileName).string() );
+  index << offline << std::endl;
+  index.close();
+
+  boost::system::error_code ec;
+  fs::rename(tmp, entry(), ec);
+  if (ec) { // entry written by another process in the meantime
+    fs::remove_all(tmp);
+    return;
+  }
+  std::cout << "* " << palattice.tool_string() << " output stored in cache " << entry().string() << std::endl;
+}
+
+
+// include statements are replaced by the included file (recursive), so the result can be written anywhere
+static std::string resolvedLattice(const fs::path &file, std::set<fs::path> &visited)
+{
+  if (!visited.insert(fs::absolute(file)).second)
+    throw std::runtime_error("Recursive include of lattice file " + file.string());
+  std::ifstream in(file.string(), std::ios::binary);
+  if (!in.is_open())
+    throw std::runtime_error("Cannot open lattice file " + file.string());
+
+  std::stringstream result;
+  std::string line;
+  while (std::getline(in, line)) {
+    fs::path included;
+    if (includedFile(file, line, included))
+      result << resolvedLattice(included, visited);
+    else
+      result << line << "\n";
+  }
+  visited.erase(fs::absolute(file));
+  return result.str();
+}
+
+std::string resolvedLattice(const fs::path &file)
+{
+  std::set<fs::path> visited;
+  return resolvedLattice(file, visited);
+}
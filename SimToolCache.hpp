@@ -0,0 +1,65 @@
+/* SimToolCache Class
+ * persistent cache of SimTool (Elegant/MadX) output files.
+ * Output of an online SimTool run is copied to a cache directory, which is named by
+ * a hash of the lattice file contents (incl. included files) and all settings passed to the SimTool.
+ * Following runs with identical lattice & settings import these files in offline mode.
+ *
+ * Copyright (C) 2017 Jan Felix Schmidt <janschmidt@mailbox.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __POLEMATRIX__SIMTOOLCACHE_HPP_
+#define __POLEMATRIX__SIMTOOLCACHE_HPP_
+
+#include <string>
+#include <cstdint>
+#include "Configuration.hpp"
+
+
+class SimToolCache
+{
+protected:
+  Configuration& config;
+  std::string key;          // hash of lattice & settings
+
+  std::string settings() const;                     // all settings, which influence SimTool output
+  fs::path offlineFile(const fs::path &dir) const;  // file to import SimTool output in offline mode
+
+public:
+  SimToolCache(Configuration& c);
+
+  bool enabled() const;     // cache configured & SimTool in online mode
+  fs::path entry() const {return config.simToolCache()/key;}
+  bool found() const {return fs::exists(offlineFile(entry()));}
+
+  void load();              // switch SimToolInstance to offline mode using cached files
+  void store();             // copy output of (executed) SimToolInstance to cache
+};
+
+
+// 64bit FNV-1a hash, stable between runs & platforms (unlike std::hash)
+std::uint64_t fnv1a(const std::string &data, std::uint64_t hash=14695981039346656037ULL);
+
+// lattice file contents followed by the contents of all files included by it (recursive):
+// elegant "#include: file", MadX "call, file=..." (relative to including file or working dir.)
+std::string latticeContent(const fs::path &file);
+
+// lattice file with all included files (see latticeContent) inserted in place of the include statements.
+// throws if an included file is missing
+std::string resolvedLattice(const fs::path &file);
+
+
+#endif
+// __POLEMATRIX__SIMTOOLCACHE_HPP_
@@ -0,0 +1,589 @@
+/* SimToolStore Class
+ * shared store of SimTool (Elegant/MadX) particle data (energy & trajectory)
+ * used by all particles of a Simulation. The data of each particle is read once
+ * and handed over to the requesting task. Elegant output is imported for the particles of the
+ * prefetch window in one pass over the watch point files (SDDS toolkit needed). Otherwise a prefetch
+ * thread reads the data of upcoming particles (one palattice import per particle) in the background.
+ * With config <compact> only samples at the lattice elements of the simulated turns are stored.
+ * Optionally the SimTool particle tracking is split into multiple runs (chunks of particles),
+ * which are executed in parallel. Tasks can start as soon as the chunk of their particle is done.
+ *
+ * Copyright (C) 2017 Jan Felix Schmidt <janschmidt@mailbox.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <fstream>
+#include <algorithm>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <gsl/gsl_spline.h>
+#ifdef POLEMATRIX_SDDS
+#include <SDDS.h>
+#endif
+#include "SimToolStore.hpp"
+#include "SimToolCache.hpp"
+#include "debug.hpp"
+
+
+#ifdef POLEMATRIX_SDDS
+namespace {
+  // SDDS file read page by page. file is closed by destructor
+  class SddsInput
+  {
+    SDDS_DATASET data;
+    bool isOpen;
+    static char* c(const std::string &s) {return const_cast<char*>(s.c_str());}
+
+  public:
+    SddsInput(const std::string &file) : isOpen(SDDS_InitializeInput(&data, c(file)) == 1) {
+      if (!isOpen)
+	SDDS_ClearErrors();
+    }
+    SddsInput(const SddsInput& o) = delete;
+    ~SddsInput() {if (isOpen) SDDS_Terminate(&data);}
+
+    bool open() const {return isOpen;}
+    bool hasColumn(const std::string &name) {return SDDS_GetColumnIndex(&data, c(name)) >= 0;}
+    bool hasParameter(const std::string &name) {return SDDS_GetParameterIndex(&data, c(name)) >= 0;}
+    bool readPage() {return SDDS_ReadPage(&data) > 0;}
+
+    double parameter(const std::string &name) {
+      double value;
+      if (!SDDS_GetParameterAsDouble(&data, c(name), &value))
+	throw std::runtime_error("SimToolStore: Cannot read SDDS parameter " + name);
+      return value;
+    }
+    std::vector<double> column(const std::string &name) {
+      int64_t rows = SDDS_CountRowsOfInterest(&data);
+      if (rows <= 0)
+	return std::vector<double>();
+      double *values = SDDS_GetColumnInDoubles(&data, c(name));
+      if (!values)
+	throw std::runtime_error("SimToolStore: Cannot read SDDS column " + name);
+      std::vector<double> v(values, values+rows);
+      std::free(values);
+      return v;
+    }
+  };
+}
+#endif
+
+
+SimToolStore::SimToolStore(const std::shared_ptr<Configuration> c, const pal::AccLattice& lattice, unsigned int firstTurn, unsigned int lastTurn,
+			   unsigned int ahead, bool gamma)
+  : config(c),
+    withGamma(gamma && (config->gammaMode()==GammaMode::simtool
+			|| config->gammaMode()==GammaMode::simtool_plus_linear
+			|| config->gammaMode()==GammaMode::simtool_no_interpolation)),
+    withTrajectory(config->trajectoryMode()==TrajectoryMode::simtool),
+#ifdef POLEMATRIX_SDDS
+    streaming(config->getSimToolInstance().tool==pal::elegant),
+#else
+    streaming(false),
+#endif
+    particles(config->nParticles()), chunkSize(config->nParticles()), firstPending(0), prefetchAhead(ahead), stop(true)
+{
+  if (lastTurn > 0 && ((withGamma && config->compactGamma() > 0.) || (withTrajectory && config->compactTrajectory() > 0.)))
+    elements.init(lattice, firstTurn, lastTurn);
+  if (config->simToolChunks() > 1)
+    initChunks(lattice);
+  // streaming: all particles are imported by SimTool runners (startPrefetch), tasks wait for them
+  if (streaming) {
+    for (Particle& p : particles)
+      p.status = Status::loading;
+  }
+}
+
+
+// each chunk is a SimTool run in its own directory (outpath/simtool_chunk_i) with a copy of the lattice file,
+// which contains all included files (relative includes would not be found from there).
+// the runs differ by the random seed, so each chunk tracks different particles
+void SimToolStore::initChunks(const pal::AccLattice& lattice)
+{
+  unsigned int n = config->simToolChunks();
+  chunkSize = (config->nParticles() + n - 1) / n;
+  fs::path latticeFile = config->simToolLatticeFile();
+  std::string content = resolvedLattice(latticeFile);
+
+  for (unsigned int first=0; first<config->nParticles(); first+=chunkSize) {
+    std::stringstream dirName;
+    dirName << "simtool_chunk_" << chunks.size();
+    fs::path dir = config->subDirectory(dirName.str());
+    fs::create_directories(dir);
+    fs::path file = dir/latticeFile.filename();
+    std::ofstream out(file.string());
+    out << content;
+    if (!out.good())
+      throw std::runtime_error("SimToolStore: Cannot write " + file.string());
+    out.close();
+
+    Chunk c;
+    c.first = first;
+    c.status = Status::empty;
+    c.sim.reset( new pal::SimToolInstance(config->getSimToolInstance().tool, pal::online, file.string()) );
+    c.sim->setNumParticles( std::min(chunkSize, config->nParticles()-first) );
+    c.sim->setMomentum_MeV( config->E0()*1000. );
+    c.sim->setSeed( chunkSeed(config->seed(), chunks.size()) ); // random_number_seed of generated .ele
+    config->setSimToolTracking(*c.sim, lattice);
+    chunks.push_back(c);
+  }
+}
+
+
+// elegant random_number_seed: positive, different for each chunk
+int SimToolStore::chunkSeed(int seed, unsigned int chunk)
+{
+  return 1 + int((unsigned(seed) + chunk) % 2147483646u);
+}
+
+
+void SimToolStore::runChunk(unsigned int i)
+{
+  std::string error;
+  if (streaming) {
+    readAll(*chunks[i].sim, chunks[i].first, std::min<std::size_t>(chunkSize, particles.size()-chunks[i].first));
+  }
+  else {
+    try {
+      chunks[i].sim->twiss(); // executes SimTool
+    }
+    catch (std::exception &e) {
+      error = e.what();
+    }
+  }
+  std::lock_guard<std::mutex> lock(mutex);
+  chunks[i].error = error;
+  chunks[i].status = Status::ready;
+  changed.notify_all();
+}
+
+
+pal::SimToolInstance& SimToolStore::simToolInstance(unsigned int id, unsigned int& simToolParticle)
+{
+  if (chunks.empty()) {
+    simToolParticle = id+1;
+    return config->getSimToolInstance();
+  }
+
+  Chunk& c = chunks.at(id/chunkSize);
+  simToolParticle = id - c.first + 1;
+  std::unique_lock<std::mutex> lock(mutex);
+  changed.wait(lock, [&c]{return c.status == Status::ready;});
+  if (!c.error.empty())
+    throw std::runtime_error(c.error);
+  return *c.sim;
+}
+
+
+bool SimToolStore::used(const Configuration& c, bool gamma)
+{
+  return (gamma && (c.gammaMode()==GammaMode::simtool
+		    || c.gammaMode()==GammaMode::simtool_plus_linear
+		    || c.gammaMode()==GammaMode::simtool_no_interpolation))
+    || c.trajectoryMode()==TrajectoryMode::simtool;
+}
+
+
+// simtool: sdds import thread safe since SDDSToolKit-devel-3.3.1-2
+void SimToolStore::read(unsigned int id, Particle& p)
+{
+  unsigned int simToolParticle;
+  auto& palattice = simToolInstance(id, simToolParticle);
+
+  if (withGamma) {
+    std::string col;
+    if (palattice.tool==pal::elegant) {
+      col = "p";
+    }
+    else if (palattice.tool==pal::madx) {
+      std::cout << "WARNING: It is recommended to use elegant for gammaModel simtool." << std::endl;
+      col = "PT";
+    }
+    p.gamma.full.reset( new GammaData(palattice, gsl_interp_akima) );
+    p.gamma.full->readSimToolParticleColumn( palattice, simToolParticle, col );
+    if (palattice.tool==pal::madx) { // madx: PT is dE/E -> gamma=(PT+1)*gamma0
+      *p.gamma.full += 1.;
+      *p.gamma.full *= palattice.readGammaCentral();
+    }
+    if (config->gammaMode() != GammaMode::simtool_no_interpolation) {
+      p.gamma.full->init();
+    }
+  }
+
+  if (withTrajectory) {
+    p.trajectory.full.reset( new TrajectoryData(palattice, gsl_interp_akima) );
+    p.trajectory.full->simToolTrajectory( palattice, simToolParticle );
+  }
+
+  save(id, p);
+  compact(id, p);
+}
+
+
+void SimToolStore::save(unsigned int id, Particle& p) const
+{
+  if ( !config->saveGamma(id) )
+    return;
+
+  std::stringstream file;
+  file <<std::setw(4)<<std::setfill('0')<< id << ".dat";
+  if (p.gamma.full) {
+    p.gamma.full->info.add("polematrix particle ID", id);
+    p.gamma.full->print( (config->outpath()/"gammaSimTool_").string() + file.str() );
+  }
+  if (p.trajectory.full) {
+    p.trajectory.full->info.add("polematrix particle ID", id);
+    p.trajectory.full->print( (config->outpath()/"trajectorySimtool_").string() + file.str() );
+  }
+}
+
+
+// sample full data at all elements of the simulated turns (2 passes: range, storage)
+// and free the palattice data (incl. interpolation) before it is stored
+void SimToolStore::compact(unsigned int id, Particle& p) const
+{
+  std::size_t n = elements.size();
+  if (n == 0)
+    return;
+  const double start = config->pos_start();
+
+  if (p.gamma.full && config->compactGamma() > 0.) {
+    bool interpolation = (config->gammaMode() != GammaMode::simtool_no_interpolation);
+    GammaData& data = *p.gamma.full;
+    auto g = [&](double pos) {
+      return interpolation ? data.interpPeriodic(pos-start) : data.infrontof(pos-start);
+    };
+    double min = g(elements.pos(0));
+    double max = min;
+    for (std::size_t i=1; i<n; i++) {
+      double value = g(elements.pos(i));
+      min = std::min(min, value);
+      max = std::max(max, value);
+    }
+    p.gamma.compact.init(n, min, max, config->compactGamma());
+    for (std::size_t i=0; i<n; i++)
+      p.gamma.compact.set(i, g(elements.pos(i)));
+    p.gamma.full.reset();
+
+    if (id == 0) {
+      std::cout << "* gamma stored at " << n << " positions (" << p.gamma.compact.encodingString() << "), "
+		<< p.gamma.compact.bytes()/1024 << " kB per particle" << std::endl;
+    }
+  }
+
+  if (p.trajectory.full && config->compactTrajectory() > 0.) {
+    TrajectoryData& data = *p.trajectory.full;
+    pal::AccPair min = data.interpPeriodic(elements.pos(0)-start);
+    pal::AccPair max = min;
+    for (std::size_t i=1; i<n; i++) {
+      pal::AccPair t = data.interpPeriodic(elements.pos(i)-start);
+      min.x = std::min(min.x, t.x);
+      min.z = std::min(min.z, t.z);
+      max.x = std::max(max.x, t.x);
+      max.z = std::max(max.z, t.z);
+    }
+    p.trajectory.x.init(n, min.x, max.x, config->compactTrajectory());
+    p.trajectory.z.init(n, min.z, max.z, config->compactTrajectory());
+    for (std::size_t i=0; i<n; i++) {
+      pal::AccPair t = data.interpPeriodic(elements.pos(i)-start);
+      p.trajectory.x.set(i, t.x);
+      p.trajectory.z.set(i, t.z);
+    }
+    p.trajectory.full.reset();
+
+    if (id == 0) {
+      std::cout << "* trajectory stored at " << n << " positions (x: " << p.trajectory.x.encodingString()
+		<< ", z: " << p.trajectory.z.encodingString() << "), "
+		<< (p.trajectory.x.bytes()+p.trajectory.z.bytes())/1024 << " kB per particle" << std::endl;
+    }
+  }
+}
+
+
+// elegant output files of the run (<rootname>.*). Only files with column particleID
+// and parameters Pass and s (WATCH elements with mode=coordinates) are used by readAll()
+std::vector<std::string> SimToolStore::watchFiles(pal::SimToolInstance& sim)
+{
+  fs::path twiss = sim.twiss(); // executes SimTool, if not done yet
+  std::string prefix = twiss.stem().string() + ".";
+  std::vector<std::string> files;
+  for (fs::directory_iterator it(twiss.parent_path()); it != fs::directory_iterator(); ++it) {
+    std::string name = it->path().filename().string();
+    if (fs::is_regular_file(it->path()) && name.compare(0, prefix.size(), prefix) == 0 && it->path() != twiss)
+      files.push_back(it->path().string());
+  }
+  std::sort(files.begin(), files.end());
+  return files;
+}
+
+
+// passes over all watch point files instead of one palattice import (file scan) per particle.
+// each pass imports the particles of the prefetch window, so only their samples are buffered.
+// particleID in SimTool run is 1...n. Particles are set ready one by one, so tasks can start early.
+void SimToolStore::readAll(pal::SimToolInstance& sim, unsigned int first, unsigned int n)
+{
+  struct Sample {
+    unsigned int turn;
+    double pos;
+    double gamma;
+    pal::AccPair trajectory;
+    bool operator<(const Sample& o) const {return turn < o.turn || (turn == o.turn && pos < o.pos);}
+  };
+  const unsigned int window = std::max(1u, prefetchAhead);
+  std::vector<std::string> files;
+  std::string error;
+  try {
+    files = watchFiles(sim);
+  }
+  catch (std::exception &e) {
+    error = e.what();
+  }
+
+  for (unsigned int begin=0; begin<n; begin+=window) {
+    unsigned int m = std::min(window, n-begin); // particles begin+1...begin+m of sim in this pass
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      changed.wait(lock, [&]{return stop || first+begin < firstPending + window;});
+      if (stop)
+	error = "SimToolStore: import of SimTool data stopped";
+    }
+    std::vector<std::vector<Sample>> samples(m);
+
+    try {
+      if (!error.empty())
+	throw std::runtime_error(error);
+#ifdef POLEMATRIX_SDDS
+      for (const std::string& file : files) {
+	SddsInput in(file);
+	if (!in.open() || !in.hasColumn("particleID") || !in.hasParameter("Pass") || !in.hasParameter("s"))
+	  continue;
+	while (in.readPage()) {
+	  Sample s;
+	  s.turn = in.parameter("Pass") + 1; // elegant: first pass is 0
+	  s.pos = in.parameter("s");
+	  std::vector<double> id = in.column("particleID");
+	  std::vector<double> p, x, y;
+	  if (withGamma)
+	    p = in.column("p");
+	  if (withTrajectory) {
+	    x = in.column("x");
+	    y = in.column("y");
+	  }
+	  for (std::size_t r=0; r<id.size(); r++) {
+	    if (id[r] < begin+1 || id[r] > begin+m)
+	      continue;
+	    if (withGamma)
+	      s.gamma = p[r];
+	    if (withTrajectory) {
+	      s.trajectory.x = x[r];
+	      s.trajectory.z = y[r];
+	    }
+	    samples[std::size_t(id[r])-1-begin].push_back(s);
+	  }
+	}
+      }
+#else
+      throw std::runtime_error("SimToolStore: polematrix built without SDDS toolkit, no streaming import");
+#endif
+    }
+    catch (std::exception &e) {
+      error = e.what();
+    }
+
+    for (unsigned int i=0; i<m; i++) {
+      unsigned int id = first+begin+i;
+      Particle tmp;
+      if (!error.empty())
+	tmp.error = error;
+      else if (samples[i].empty())
+	tmp.error = "SimToolStore: no elegant watch point data (WATCH mode=coordinates) of particle "
+	  + std::to_string(begin+i+1) + " in " + sim.inFile();
+      else {
+	try {
+	  std::sort(samples[i].begin(), samples[i].end());
+	  if (withGamma) {
+	    tmp.gamma.full.reset( new GammaData(sim, gsl_interp_akima) );
+	    for (const Sample& s : samples[i])
+	      tmp.gamma.full->set(s.gamma, s.pos, s.turn);
+	    if (config->gammaMode() != GammaMode::simtool_no_interpolation)
+	      tmp.gamma.full->init();
+	  }
+	  if (withTrajectory) {
+	    tmp.trajectory.full.reset( new TrajectoryData(sim, gsl_interp_akima) );
+	    for (const Sample& s : samples[i])
+	      tmp.trajectory.full->set(s.trajectory, s.pos, s.turn);
+	    tmp.trajectory.full->init();
+	  }
+	  save(id, tmp);
+	  compact(id, tmp);
+	}
+	catch (std::exception &e) {
+	  tmp.error = e.what();
+	}
+      }
+      std::vector<Sample>().swap(samples[i]); // free memory
+
+      std::lock_guard<std::mutex> lock(mutex);
+      Particle& p = particles.at(id);
+      p.gamma = std::move(tmp.gamma);
+      p.trajectory = std::move(tmp.trajectory);
+      p.error = tmp.error;
+      p.status = Status::ready;
+      changed.notify_all();
+    }
+  }
+}
+
+
+// read data of particle id, mutex is unlocked during reading
+void SimToolStore::load(std::unique_lock<std::mutex>& lock, unsigned int id)
+{
+  Particle& p = particles.at(id);
+  p.status = Status::loading;
+  lock.unlock();
+  Particle tmp;
+  try {
+    read(id, tmp);
+  }
+  catch (std::exception &e) {
+    tmp.error = e.what();
+  }
+  lock.lock();
+  p.gamma = std::move(tmp.gamma);
+  p.trajectory = std::move(tmp.trajectory);
+  p.error = tmp.error;
+  p.status = Status::ready;
+  changed.notify_all();
+}
+
+
+SimToolStore::GammaSamples SimToolStore::takeGamma(unsigned int id)
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  Particle& p = particles.at(id);
+  if (p.gammaTaken)
+    throw std::runtime_error("SimToolStore: SimTool energy of particle " + std::to_string(id) + " has already been handed over");
+  if (p.status == Status::empty)
+    load(lock, id);
+  changed.wait(lock, [&p]{return p.status == Status::ready;});
+  p.gammaTaken = true;
+  if (!p.error.empty()) {
+    handedOver(id);
+    throw std::runtime_error(p.error);
+  }
+
+  GammaSamples g;
+  std::swap(g, p.gamma);
+  handedOver(id);
+  return g;
+}
+
+
+SimToolStore::TrajectorySamples SimToolStore::takeTrajectory(unsigned int id)
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  Particle& p = particles.at(id);
+  if (p.trajectoryTaken)
+    throw std::runtime_error("SimToolStore: SimTool trajectory of particle " + std::to_string(id) + " has already been handed over");
+  if (p.status == Status::empty)
+    load(lock, id);
+  changed.wait(lock, [&p]{return p.status == Status::ready;});
+  p.trajectoryTaken = true;
+  if (!p.error.empty()) {
+    handedOver(id);
+    throw std::runtime_error(p.error);
+  }
+
+  TrajectorySamples t;
+  std::swap(t, p.trajectory);
+  handedOver(id);
+  return t;
+}
+
+
+bool SimToolStore::complete(const Particle& p) const
+{
+  if (p.status != Status::ready)
+    return false;
+  if (!p.error.empty())
+    return true;
+  return (p.gammaTaken || !withGamma) && (p.trajectoryTaken || !withTrajectory);
+}
+
+
+// move prefetch window, if all data of a particle has been taken (mutex locked by caller)
+void SimToolStore::handedOver(unsigned int id)
+{
+  if (id != firstPending)
+    return;
+  while (firstPending < particles.size() && complete(particles[firstPending]))
+    firstPending++;
+  changed.notify_all();
+}
+
+
+void SimToolStore::prefetch()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  while (!stop) {
+    unsigned int end = std::min<std::size_t>(firstPending + prefetchAhead, particles.size());
+    unsigned int id = firstPending;
+    while (id < end && particles[id].status != Status::empty)
+      id++;
+
+    if (id < end)
+      load(lock, id);
+    else if (firstPending >= particles.size())
+      return;
+    else
+      changed.wait(lock);
+  }
+}
+
+
+void SimToolStore::startPrefetch()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  if (!stop)
+    return;
+  stop = false;
+  if (chunkRunners.empty()) {
+    for (auto i=0u; i<chunks.size(); i++)
+      chunkRunners.emplace_back(&SimToolStore::runChunk, this, i);
+    if (streaming && chunks.empty())
+      chunkRunners.emplace_back(&SimToolStore::readAll, this, std::ref(config->getSimToolInstance()), 0u, unsigned(particles.size()));
+  }
+  if (prefetchAhead == 0 || streaming)
+    return;
+  prefetcher = std::thread(&SimToolStore::prefetch, this);
+  polematrix::debug(__PRETTY_FUNCTION__, "prefetch thread started");
+}
+
+
+void SimToolStore::stopPrefetch()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stop = true;
+    changed.notify_all();
+  }
+  if (prefetcher.joinable())
+    prefetcher.join();
+  for (std::thread& t : chunkRunners) {
+    if (t.joinable())
+      t.join();
+  }
+}
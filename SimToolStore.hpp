@@ -0,0 +1,132 @@
+/* SimToolStore Class
+ * shared store of SimTool (Elegant/MadX) particle data (energy & trajectory)
+ * used by all particles of a Simulation. The data of each particle is read once
+ * and handed over to the requesting task. Elegant output is imported for the particles of the
+ * prefetch window in one pass over the watch point files (SDDS toolkit needed). Otherwise a prefetch
+ * thread reads the data of upcoming particles (one palattice import per particle) in the background.
+ * With config <compact> only samples at the lattice elements of the simulated turns are stored.
+ * Optionally the SimTool particle tracking is split into multiple runs (chunks of particles),
+ * which are executed in parallel. Tasks can start as soon as the chunk of their particle is done.
+ *
+ * Copyright (C) 2017 Jan Felix Schmidt <janschmidt@mailbox.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __POLEMATRIX__SIMTOOLSTORE_HPP_
+#define __POLEMATRIX__SIMTOOLSTORE_HPP_
+
+#include <memory>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <libpalattice/FunctionOfPos.hpp>
+#include <libpalattice/AccLattice.hpp>
+#include "Configuration.hpp"
+#include "CompactSamples.hpp"
+
+
+class SimToolStore
+{
+public:
+  typedef pal::FunctionOfPos<double> GammaData;
+  typedef pal::FunctionOfPos<pal::AccPair> TrajectoryData;
+
+  // data of one particle: full palattice data or compact samples at all elements of sampling() (config <compact>)
+  struct GammaSamples {
+    std::shared_ptr<GammaData> full;
+    CompactSamples compact;
+  };
+  struct TrajectorySamples {
+    std::shared_ptr<TrajectoryData> full;
+    CompactSamples x, z;
+  };
+
+protected:
+  enum class Status {empty, loading, ready};
+  struct Particle {
+    Status status;
+    GammaSamples gamma;
+    TrajectorySamples trajectory;
+    bool gammaTaken;
+    bool trajectoryTaken;
+    std::string error;
+    Particle() : status(Status::empty), gammaTaken(false), trajectoryTaken(false) {}
+  };
+  struct Chunk {
+    std::shared_ptr<pal::SimToolInstance> sim;
+    unsigned int first;  // particleId of first particle in this chunk
+    Status status;
+    std::string error;
+  };
+
+  const std::shared_ptr<Configuration> config;
+  const bool withGamma;       // gammaMode simtool*
+  const bool withTrajectory;  // trajectoryMode simtool
+  const bool streaming;       // elegant: particles of a SimTool run are imported together (passes over watch files)
+  ElementSampling elements;   // compact storage: all elements of the simulated turns (empty: not used)
+  std::vector<Particle> particles;
+  std::vector<Chunk> chunks;  // separate SimTool runs for particle tracking (config <chunks>), empty if not used
+  unsigned int chunkSize;
+  unsigned int firstPending;  // lowest particleId with data not handed over completely
+  unsigned int prefetchAhead; // max. number of particles read in advance (from firstPending), also streaming
+
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::thread prefetcher;
+  std::vector<std::thread> chunkRunners; // SimTool runs of chunks (streaming: also import of main run)
+  bool stop;
+
+  void initChunks(const pal::AccLattice& lattice);
+  static int chunkSeed(int seed, unsigned int chunk); // SimTool random seed of chunk
+  void runChunk(unsigned int i);
+  // SimToolInstance containing particle id (waits for chunk) and particle number in SimTool
+  pal::SimToolInstance& simToolInstance(unsigned int id, unsigned int& simToolParticle);
+  void read(unsigned int id, Particle& p);       // read SimTool data (no lock needed)
+  void save(unsigned int id, Particle& p) const; // export full data (config <saveGamma>)
+  void compact(unsigned int id, Particle& p) const; // replace full data by compact samples (config <compact>)
+  // read particles first...first+n-1 (particle 1...n of sim) in passes of prefetchAhead particles, sets them ready
+  void readAll(pal::SimToolInstance& sim, unsigned int first, unsigned int n);
+  static std::vector<std::string> watchFiles(pal::SimToolInstance& sim); // candidates for elegant watch point output
+  bool complete(const Particle& p) const;        // all data handed over or failed
+  void load(std::unique_lock<std::mutex>& lock, unsigned int id);
+  void handedOver(unsigned int id);
+  void prefetch();
+
+public:
+  // firstTurn...lastTurn: turns used by the simulation, for compact storage (lastTurn=0: unknown, full data stored)
+  SimToolStore(const std::shared_ptr<Configuration> c, const pal::AccLattice& lattice, unsigned int firstTurn, unsigned int lastTurn,
+	       unsigned int ahead, bool gamma=true);
+  SimToolStore(const SimToolStore& o) = delete;
+  ~SimToolStore() {stopPrefetch();}
+
+  // is SimTool particle data needed for this configuration?
+  static bool used(const Configuration& c, bool gamma=true);
+
+  void startPrefetch();                        // also starts SimTool runs of chunks / streaming import
+  void stopPrefetch();                         // waits for SimTool runs of chunks
+
+  // hand over data of particle id. It is read, if not prefetched yet.
+  // The store does not keep the data afterwards, so it can be taken only once (throws otherwise).
+  GammaSamples takeGamma(unsigned int id);
+  TrajectorySamples takeTrajectory(unsigned int id);
+
+  // sample positions of compact data (copy it, its cursor is not thread safe)
+  const ElementSampling& sampling() const {return elements;}
+};
+
+
+#endif
+// __POLEMATRIX__SIMTOOLSTORE_HPP_
@@ -37,11 +37,21 @@ SingleParticleSimulation::SingleParticleSimulation(unsigned int id, const std::s
 }
 
 
-void SingleParticleSimulation::setModel(std::shared_ptr<const pal::AccLattice> l, std::shared_ptr<const pal::FunctionOfPos<pal::AccPair>> o)
+void SingleParticleSimulation::setModel(std::shared_ptr<const pal::AccLattice> l, std::shared_ptr<const pal::FunctionOfPos<pal::AccPair>> o,
+					std::shared_ptr<SimToolStore> s, std::shared_ptr<const ElementFields> f,
+					std::shared_ptr<const StartSequence> q, std::shared_ptr<const OscillationTable> t)
 {
   lattice = l;
   orbit = o;
+  simToolStore = s;
+  elementFields = f;
+  startSequence = q;
+  oscillationTable = t;
   trajectory->setOrbit(orbit);
+  trajectory->setLattice(lattice);
+  trajectory->setSimToolStore(simToolStore);
+  trajectory->setStartSequence(startSequence);
+  trajectory->setOscillationTable(oscillationTable);
 }
 
 
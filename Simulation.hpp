@@ -29,6 +29,10 @@
 #include <vector>
 #include "Configuration.hpp"
 #include "Trajectory.hpp"
+#include "SimToolCache.hpp"
+#include "SimToolStore.hpp"
+#include "ElementFields.hpp"
+#include "StartDistribution.hpp"
 
 
 // abstract base class for a simulation task for a single particle
@@ -38,6 +42,10 @@
 class SingleParticleSimulation {
 protected:
   std::unique_ptr<Trajectory> trajectory;     // particle trajectory, implementation depends TrajectoryMode
+  std::shared_ptr<SimToolStore> simToolStore; // SimTool particle data (simtool modes only)
+  std::shared_ptr<const ElementFields> elementFields; // fields at closed orbit (trajectoryMode closed_orbit only)
+  std::shared_ptr<const StartSequence> startSequence; // quasi-random start points (config <sampling>)
+  std::shared_ptr<const OscillationTable> oscillationTable; // trajectoryMode oscillation only
   
 public:
   const unsigned int particleId;
@@ -46,9 +54,15 @@ public:
   std::shared_ptr<const pal::FunctionOfPos<pal::AccPair>> orbit;
 
   SingleParticleSimulation(unsigned int id, const std::shared_ptr<Configuration> c);
-  void setModel(std::shared_ptr<const pal::AccLattice> l, std::shared_ptr<const pal::FunctionOfPos<pal::AccPair>> o);
+  void setModel(std::shared_ptr<const pal::AccLattice> l, std::shared_ptr<const pal::FunctionOfPos<pal::AccPair>> o,
+		std::shared_ptr<SimToolStore> s=nullptr, std::shared_ptr<const ElementFields> f=nullptr,
+		std::shared_ptr<const StartSequence> q=nullptr, std::shared_ptr<const OscillationTable> t=nullptr);
   
   virtual void run() =0;
+  // energy gamma(pos) is imported from SimToolStore in gammaMode simtool (hidden by derived classes)
+  static bool usesSimToolGamma() {return false;}
+  // turns of SimTool particle data used by the tasks, for compact storage in SimToolStore (last=0: unknown)
+  static void simToolTurns(const Configuration&, const pal::FunctionOfPos<pal::AccPair>&, unsigned int &first, unsigned int &last) {first=last=0;}
 
   virtual double getProgress() const =0; // progress [0,1] for status output
   virtual std::string getProgressBar(unsigned int barWidth) const;
@@ -67,6 +81,10 @@ class Simulation {
 protected:
   std::shared_ptr<pal::AccLattice> lattice;
   std::shared_ptr<pal::FunctionOfPos<pal::AccPair>> orbit;
+  std::shared_ptr<SimToolStore> simToolStore;
+  std::shared_ptr<const ElementFields> elementFields;
+  std::shared_ptr<const StartSequence> startSequence;
+  std::shared_ptr<const OscillationTable> oscillationTable;
 
   // queue
   typedef typename std::vector<T>::iterator taskIterator;
@@ -84,24 +102,28 @@ protected:
   void startThreads();
   void waitForThreads();
   void processQueue();
+  void stopQueue();          // no further tasks are started (one task per particle), running tasks are completed
+  bool tasksLeft();          // queued or running tasks
   void printProgress() const;
+  virtual void taskFinished(T&) {} // called by worker thread after each successful task, e.g. to merge its results
   
   std::map<unsigned int,std::string> errors;
+  unsigned int skipped; // particles of config nParticles not tracked (stopQueue())
 
 public:
   const std::shared_ptr<Configuration> config;
   bool showProgressBar;
   
   Simulation(unsigned int nThreads=std::thread::hardware_concurrency())
-    : queueIt(queue.begin()), config(new Configuration), showProgressBar(true) {initThreadPool(nThreads);}
+    : queueIt(queue.begin()), skipped(0), config(new Configuration), showProgressBar(true) {initThreadPool(nThreads);}
   Simulation(const std::shared_ptr<Configuration> c, unsigned int nThreads=std::thread::hardware_concurrency())
-    : queueIt(queue.begin()), config(c), showProgressBar(true) {initThreadPool(nThreads);}
+    : queueIt(queue.begin()), skipped(0), config(c), showProgressBar(true) {initThreadPool(nThreads);}
   Simulation(const Simulation& o) = delete;
   
   void setModel();
   
   bool modelReady() {if (lattice->size()==0 || orbit->size()==0) return false; else return true;}
-  unsigned int numParticles() const {return config->nParticles();}
+  unsigned int numParticles() const {return config->nParticles() - skipped;}
   unsigned int numSuccessful() const {return numParticles() - errors.size();}
     
   virtual void start() =0;
@@ -135,6 +157,8 @@ void Simulation<T>::initThreadPool(unsigned int nThreads)
 template <typename T>
 void Simulation<T>::startThreads()
 {
+  if (simToolStore)
+    simToolStore->startPrefetch();
   for (std::thread& t : threadPool) {
     t = std::thread(&Simulation::processQueue,this);
   }
@@ -151,6 +175,8 @@ void Simulation<T>::waitForThreads()
   for (std::thread& t : threadPool) {
     t.join();
   }
+  if (simToolStore)
+    simToolStore->stopPrefetch();
   if (showProgressBar) {
     progress.join();
   }
@@ -159,12 +185,53 @@ void Simulation<T>::waitForThreads()
 template <typename T>
 void Simulation<T>::setModel()
 {
+  // reuse SimTool output of previous run with same lattice & settings, if available
+  SimToolCache cache(*config);
+  bool storeInCache = false;
+  if (cache.enabled()) {
+    if (cache.found())
+      cache.load();
+    else
+      storeInCache = true;
+  }
+
   auto& palattice = config->getSimToolInstance();
   lattice.reset( new pal::AccLattice(palattice) );
   orbit.reset( new pal::FunctionOfPos<pal::AccPair>(palattice) );
   config->updateSimToolSettings(*lattice);
   orbit->simToolClosedOrbit( palattice );
-  config->writeRfMagnetsToLattice(*lattice);
+  auto rfElements = config->writeRfMagnetsToLattice(*lattice);
+
+  if (storeInCache)
+    cache.store();
+
+  // fields at closed orbit are the same for all particles & turns,
+  // otherwise fields can be linearized (affine in x,z) for most elements
+  auto fields = std::make_shared<ElementFields>();
+  fields->initRf(lattice->size(), rfElements);
+  if (config->trajectoryMode() == TrajectoryMode::closed_orbit) {
+    fields->initOrbit(*lattice, *orbit, config->edgefoc());
+  }
+  else if (config->linearFields()) {
+    fields->initLinear(*lattice);
+    std::cout << "* linearized fields used for " << fields->numLinear() << " of " << lattice->size() << " elements" << std::endl;
+  }
+  elementFields = fields;
+
+  // quasi-random start points of all particles are generated once
+  if (StartSequence::used(*config))
+    startSequence = std::make_shared<const StartSequence>(*config);
+
+  // beta function & phase advance at all elements are the same for all particles
+  if (config->trajectoryMode() == TrajectoryMode::oscillation)
+    oscillationTable = std::make_shared<const OscillationTable>(config, *lattice, *orbit);
+
+  // particle data is read once per particle and prefetched for the next tasks
+  if (SimToolStore::used(*config, T::usesSimToolGamma())) {
+    unsigned int firstTurn, lastTurn;
+    T::simToolTurns(*config, *orbit, firstTurn, lastTurn);
+    simToolStore.reset( new SimToolStore(config, *lattice, firstTurn, lastTurn, threadPool.size(), T::usesSimToolGamma()) );
+  }
 
   if (config->gammaMode() == GammaMode::simtool
       || config->gammaMode() == GammaMode::simtool_plus_linear
@@ -192,8 +259,9 @@ void Simulation<T>::processQueue()
       runningTasks.push_back(myTask); // to display progress
       mutex.unlock();
       try {
-	myTask->setModel(lattice, orbit);
+	myTask->setModel(lattice, orbit, simToolStore, elementFields, startSequence, oscillationTable);
 	myTask->run(); // run next queued task
+	taskFinished(*myTask);
       }
       //cancel thread in error case
       catch (std::exception &e) {
@@ -213,6 +281,26 @@ void Simulation<T>::processQueue()
 }
 
 
+// tasks not started are removed from the queue, so it contains all tracked particles afterwards
+template <typename T>
+void Simulation<T>::stopQueue()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  std::size_t started = queueIt - queue.begin();
+  skipped += queue.size() - started;
+  while (queue.size() > started)
+    queue.pop_back(); // no reallocation, iterators of running tasks stay valid
+  queueIt = queue.end();
+}
+
+template <typename T>
+bool Simulation<T>::tasksLeft()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return queueIt != queue.end() || !runningTasks.empty();
+}
+
+
 template <typename T>
 std::string Simulation<T>::printErrors() const
 {
@@ -0,0 +1,116 @@
+/* SpinHistograms Class
+ * distribution of the spin vectors of all particles for each output step:
+ * histograms of Sx, Sz, Ss, |S_perp| (perpendicular to vertical axis z) and the angle to z.
+ * Filled from the stored spins of all successfully tracked particles after tracking,
+ * so no per-particle spin output is needed to analyze the spin distribution.
+ *
+ * Copyright (C) 2017 Jan Felix Schmidt <janschmidt@mailbox.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cmath>
+#include <sstream>
+#include <iomanip>
+#include <stdexcept>
+#include "SpinHistograms.hpp"
+
+
+SpinHistograms::SpinHistograms(unsigned int steps, unsigned int bins)
+  : nSteps(steps), nBins(bins), counts(std::size_t(steps)*numQuantities*bins, 0)
+{
+}
+
+
+std::string SpinHistograms::name(Quantity q)
+{
+  switch (q) {
+  case Sx:
+    return "Sx";
+  case Sz:
+    return "Sz";
+  case Ss:
+    return "Ss";
+  case Sperp:
+    return "|S_perp|";
+  default:
+    return "angle_z";
+  }
+}
+
+
+// value max. is included in last bin
+void SpinHistograms::fill(unsigned int step, Quantity q, double value)
+{
+  int bin = std::floor( (value-min(q)) / (max(q)-min(q)) * nBins );
+  bin = std::min(std::max(bin, 0), int(nBins)-1);
+  counts[index(step,q,bin)]++;
+}
+
+
+// spin vector s: (x,s,z)
+void SpinHistograms::add(unsigned int step, const arma::colvec3 &s)
+{
+  if (step >= nSteps)
+    return;
+  double norm = arma::norm(s);
+  fill(step, Sx, s(0));
+  fill(step, Sz, s(2));
+  fill(step, Ss, s(1));
+  fill(step, Sperp, std::sqrt(s(0)*s(0) + s(1)*s(1)));
+  fill(step, angle, (norm > 0.) ? std::acos(std::max(-1., std::min(1., s(2)/norm))) * 180./M_PI : 0.);
+}
+
+
+void SpinHistograms::operator+=(const SpinHistograms &other)
+{
+  if (nSteps != other.nSteps || nBins != other.nBins)
+    throw std::runtime_error("SpinHistograms::operator+= not possible for histograms of different size");
+  for (std::size_t i=0; i<counts.size(); i++)
+    counts[i] += other.counts[i];
+}
+
+
+unsigned int SpinHistograms::entries(unsigned int step) const
+{
+  unsigned int n = 0;
+  for (unsigned int b=0; b<nBins; b++)
+    n += count(step, Sx, b);
+  return n;
+}
+
+
+std::string SpinHistograms::print(const std::vector<double> &t) const
+{
+  const unsigned int w = 14;
+  std::stringstream s;
+  s << "# " << nBins << " bins:";
+  for (unsigned int q=0; q<numQuantities; q++)
+    s << " " << name(Quantity(q)) << " [" << min(Quantity(q)) << "," << max(Quantity(q)) << "]";
+  s << " (angle_z in degree)" << std::endl;
+  s << "#"<<std::setw(w+1)<< "t / s" <<std::setw(10)<< "quantity" << "  counts per bin" << std::endl;
+
+  for (unsigned int i=0; i<nSteps && i<t.size(); i++) {
+    if (entries(i) == 0)
+      continue;
+    for (unsigned int q=0; q<numQuantities; q++) {
+      s << std::resetiosflags(std::ios::fixed)<<std::setiosflags(std::ios::scientific)
+	<<std::showpoint<<std::setprecision(8)<<std::setw(w+2)<< t[i] <<std::setw(10)<< name(Quantity(q)) << " ";
+      for (unsigned int b=0; b<nBins; b++)
+	s << " " << count(i, Quantity(q), b);
+      s << std::endl;
+    }
+  }
+  return s.str();
+}
@@ -0,0 +1,66 @@
+/* SpinHistograms Class
+ * distribution of the spin vectors of all particles for each output step:
+ * histograms of Sx, Sz, Ss, |S_perp| (perpendicular to vertical axis z) and the angle to z.
+ * Filled from the stored spins of all successfully tracked particles after tracking,
+ * so no per-particle spin output is needed to analyze the spin distribution.
+ *
+ * Copyright (C) 2017 Jan Felix Schmidt <janschmidt@mailbox.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __POLEMATRIX__SPINHISTOGRAMS_HPP_
+#define __POLEMATRIX__SPINHISTOGRAMS_HPP_
+
+#include <vector>
+#include <string>
+#define ARMA_NO_DEBUG
+#include <armadillo>
+
+
+class SpinHistograms
+{
+public:
+  enum Quantity {Sx, Sz, Ss, Sperp, angle, numQuantities};
+
+protected:
+  const unsigned int nSteps;
+  const unsigned int nBins;
+  std::vector<unsigned int> counts; // index: (step*numQuantities + quantity)*nBins + bin
+
+  std::size_t index(unsigned int step, Quantity q, unsigned int bin) const {return (std::size_t(step)*numQuantities + q)*nBins + bin;}
+  void fill(unsigned int step, Quantity q, double value);
+
+public:
+  SpinHistograms(unsigned int steps, unsigned int bins);
+
+  static double min(Quantity q) {return (q==Sperp || q==angle) ? 0. : -1.;}
+  static double max(Quantity q) {return (q==angle) ? 180. : 1.;}
+  static std::string name(Quantity q);
+
+  unsigned int steps() const {return nSteps;}
+  unsigned int bins() const {return nBins;}
+  unsigned int count(unsigned int step, Quantity q, unsigned int bin) const {return counts[index(step,q,bin)];}
+  unsigned int entries(unsigned int step) const;  // number of spins in step
+
+  void add(unsigned int step, const arma::colvec3 &s); // steps out of range are ignored
+  void operator+=(const SpinHistograms &other);      // merge histograms of another particle
+
+  // one line per step & quantity: time, quantity, counts of all bins. time of step i is t[i]
+  std::string print(const std::vector<double> &t) const;
+};
+
+
+#endif
+// __POLEMATRIX__SPINHISTOGRAMS_HPP_
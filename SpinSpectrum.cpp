@@ -0,0 +1,87 @@
+/* SpinSpectrum Class
+ * spectrum of the spin precession of one particle, calculated during tracking:
+ * the horizontal spin components (Sx + i*Ss) are sampled once per turn (or every n-th turn)
+ * and Fourier transformed in windows of a fixed number of samples (Hann window).
+ * Each frequency bin is a single-bin DFT accumulated sample by sample (as Goertzel filter),
+ * so no spin time series has to be stored. The peak frequency is the fractional spin tune.
+ *
+ * Copyright (C) 2017 Jan Felix Schmidt <janschmidt@mailbox.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cmath>
+#include <algorithm>
+#include "SpinSpectrum.hpp"
+
+
+SpinSpectrum::SpinSpectrum(unsigned int samples, unsigned int turnsPerSample, unsigned int bins)
+  : nSamples(samples), every(turnsPerSample), turn(0), sample(0), weightSum(0.),
+    sum(bins, 0.), phasor(bins, 1.), step(bins)
+{
+  for (unsigned int k=0; k<bins; k++)
+    step[k] = std::polar(1., -2*M_PI*frequency(k,bins));
+}
+
+
+double SpinSpectrum::window(unsigned int n) const
+{
+  return 0.5 * (1. - std::cos(2*M_PI*n/(nSamples-1)));
+}
+
+
+// power normalized to 1 for a spin rotating with a bin frequency.
+// positive vertical field rotates x towards s (TrackingTask::rotMatrix), so Sx+i*Ss precesses with +spin tune,
+// for negative field Sx-i*Ss does (same orientation as SpinTuneTask::invariantAxis)
+void SpinSpectrum::addTurn(double t, const arma::colvec3 &s, double guideField)
+{
+  if (turn++ % every != 0)
+    return;
+
+  double orientation = (guideField < 0.) ? -1. : 1.;
+  std::complex<double> z = window(sample) * std::complex<double>(s(0), orientation*s(1));
+  weightSum += window(sample);
+  for (unsigned int k=0; k<bins(); k++) {
+    sum[k] += z * phasor[k];
+    phasor[k] *= step[k];
+  }
+
+  // window completed: store spectrum, restart recurrence
+  if (++sample == nSamples) {
+    std::vector<double> power(bins());
+    for (unsigned int k=0; k<bins(); k++)
+      power[k] = std::norm(sum[k]) / (weightSum*weightSum);
+    spectra.insert(std::make_pair(t, power));
+    sample = 0;
+    weightSum = 0.;
+    sum.assign(bins(), 0.);
+    phasor.assign(bins(), 1.);
+  }
+}
+
+
+// frequency range is periodic: neighbours of the first/last bin are the last/first bin
+double SpinSpectrum::peak(const std::vector<double> &power)
+{
+  unsigned int n = power.size();
+  if (n == 0)
+    return 0.;
+  unsigned int k = std::max_element(power.begin(), power.end()) - power.begin();
+  double prev = power[(k+n-1)%n];
+  double next = power[(k+1)%n];
+  double denom = prev - 2*power[k] + next;
+  double offset = (n > 2 && denom < 0.) ? 0.5*(prev-next)/denom : 0.;
+  double f = frequency(k+offset, n);
+  return f - std::floor(f);
+}
@@ -0,0 +1,66 @@
+/* SpinSpectrum Class
+ * spectrum of the spin precession of one particle, calculated during tracking:
+ * the horizontal spin components (Sx + i*Ss) are sampled once per turn (or every n-th turn)
+ * and Fourier transformed in windows of a fixed number of samples (Hann window).
+ * Each frequency bin is a single-bin DFT accumulated sample by sample (as Goertzel filter),
+ * so no spin time series has to be stored. The peak frequency is the fractional spin tune.
+ *
+ * Copyright (C) 2017 Jan Felix Schmidt <janschmidt@mailbox.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __POLEMATRIX__SPINSPECTRUM_HPP_
+#define __POLEMATRIX__SPINSPECTRUM_HPP_
+
+#include <vector>
+#include <map>
+#include <complex>
+#define ARMA_NO_DEBUG
+#include <armadillo>
+
+
+class SpinSpectrum
+{
+protected:
+  unsigned int nSamples;   // samples per window
+  unsigned int every;      // turns per sample
+  unsigned int turn;       // turns since start
+  unsigned int sample;     // samples in current window
+  double weightSum;        // sum of window function in current window
+  std::vector<std::complex<double>> sum;    // DFT of current window, per frequency bin
+  std::vector<std::complex<double>> phasor; // exp(-2pi i f_k n) for current sample n
+  std::vector<std::complex<double>> step;   // exp(-2pi i f_k)
+  std::map<double,std::vector<double>> spectra; // power per bin for each window (time of window end)
+
+  double window(unsigned int n) const;     // Hann window, n < nSamples
+
+public:
+  SpinSpectrum(unsigned int samples=2, unsigned int turnsPerSample=1, unsigned int bins=0);
+
+  // spin s (x,s,z) after a turn ending at time t. the sign of the vertical guide field (e.g. sum of Bint.z)
+  // orients the precession, so the peak is the fractional spin tune for both field polarities
+  void addTurn(double t, const arma::colvec3 &s, double guideField=1.);
+  unsigned int bins() const {return step.size();}
+  const std::map<double,std::vector<double>>& get() const {return spectra;}
+
+  // frequency per sample, i.e. fractional spin tune for one sample per turn
+  static double frequency(double bin, unsigned int bins) {return bin/bins;}
+  // frequency of maximum power, parabolic interpolation between bins
+  static double peak(const std::vector<double> &power);
+};
+
+
+#endif
+// __POLEMATRIX__SPINSPECTRUM_HPP_
@@ -0,0 +1,154 @@
+/* SpinTuneSolver Classes
+ * invariant spin axis n0 and spin tune on the closed orbit from the one-turn spin map.
+ * The one-turn map is the product of the spin rotations of all lattice elements
+ * (as in TrackingTask::matrixTracking() with trajectoryModel closed orbit).
+ * A scan over energy is parallelized by the thread pool (one task per energy).
+ *
+ * Copyright (C) 2017 Jan Felix Schmidt <janschmidt@mailbox.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <iomanip>
+#include <cmath>
+#include "SpinTuneSolver.hpp"
+#include "TrackingTask.hpp"
+#include "ResStrengths.hpp" // agammaGrid()
+
+
+SpinTuneTask::SpinTuneTask(unsigned int id, const std::shared_ptr<Configuration> c, double a)
+  : SingleParticleSimulation(id,c), done(false), agamma(a), spinTune(0.)
+{
+  oneTurnMap.eye();
+  n0.zeros();
+}
+
+
+// fields on closed orbit are taken from ElementFields (rf magnets not included)
+void SpinTuneTask::run()
+{
+  if (!elementFields || !elementFields->hasOrbit())
+    throw std::runtime_error("SpinTuneTask: fields on closed orbit not available");
+
+  double gamma = agamma / config->a_gyro;
+  arma::colvec3 guideField = {0.,0.,0.};
+  oneTurnMap.eye();
+  for (unsigned int i=0; i<lattice->size(); i++) {
+    pal::AccTriple omega = elementFields->Bint(i);
+    omega.x += elementFields->edgeBx(i);
+    guideField += arma::colvec3({omega.x, omega.s, omega.z});
+    omega = omega * config->a_gyro;
+    omega.x *= gamma;
+    omega.z *= gamma;
+    oneTurnMap = TrackingTask::rotMatrix(omega) * oneTurnMap;
+  }
+
+  invariantAxis(oneTurnMap, guideField, n0, spinTune);
+  done = true;
+}
+
+
+// n0: eigenvector for eigenvalue 1, i.e. orthogonal to all rows of (M-1).
+// largest cross product of two rows is most accurate. M=1 (integer spin tune): n0 undefined, use field direction
+void SpinTuneTask::invariantAxis(const arma::mat33 &M, const arma::colvec3 &guideField, arma::colvec3 &n, double &tune)
+{
+  arma::mat33 A = M;
+  for (unsigned int i=0; i<3; i++)
+    A(i,i) -= 1.;
+  arma::colvec3 row[3];
+  for (unsigned int i=0; i<3; i++)
+    row[i] = {A(i,0), A(i,1), A(i,2)};
+  n = guideField;
+  double max = 0.;
+  for (unsigned int i=0; i<3; i++) {
+    arma::colvec3 c = arma::cross(row[i], row[(i+1)%3]);
+    double norm = arma::norm(c);
+    if (norm > max) {
+      max = norm;
+      n = c;
+    }
+  }
+  n = arma::normalise(n);
+  // orientation: spin tune = agamma (mod 1) for a flat ring independent of field polarity
+  if (arma::dot(n, guideField) < 0.)
+    n *= -1.;
+
+  // rotation angle around n: cos from trace, sin from antisymmetric part
+  double c = 0.5 * (arma::trace(M) - 1.);
+  arma::colvec3 axis = {M(2,1)-M(1,2), M(0,2)-M(2,0), M(1,0)-M(0,1)};
+  double s = 0.5 * arma::dot(axis, n);
+  tune = std::atan2(s, c) / (2*M_PI);
+  if (tune < 0.)
+    tune += 1.;
+}
+
+
+
+
+
+// only the closed orbit is needed: no SimTool particle tracking
+SpinTuneSolver::SpinTuneSolver(const std::shared_ptr<Configuration> c, unsigned int nThreads)
+  : Simulation(c, nThreads)
+{
+  showProgressBar = false;
+  config->set_trajectoryMode(TrajectoryMode::closed_orbit);
+  if (config->simToolTracking())
+    config->set_gammaMode(GammaMode::linear);
+}
+
+
+void SpinTuneSolver::start()
+{
+  std::vector<double> grid = agammaGrid(*config);
+  queue.clear();
+  for (unsigned int i=0; i<grid.size(); i++)
+    queue.emplace_back( SpinTuneTask(i, config, grid[i]) );
+  queueIt = queue.begin();
+
+  startThreads();
+  waitForThreads();
+  std::cout << printErrors();
+}
+
+
+std::string SpinTuneSolver::print() const
+{
+  const unsigned int w = 16;
+  std::stringstream s;
+  s << "#"<<std::setw(w)<< "agamma" <<std::setw(w)<< "E / GeV" <<std::setw(w)<< "spin tune"
+    <<std::setw(w)<< "n0x" <<std::setw(w)<< "n0z" <<std::setw(w)<< "n0s" << std::endl;
+  for (auto &task : queue) {
+    if (errors.count(task.particleId) > 0)
+      continue;
+    s <<resetiosflags(ios::scientific)<<setiosflags(ios::fixed)<<setprecision(6)
+      <<std::setw(1+w)<< task.agamma <<std::setw(w)<< task.agamma/config->a_gyro * config->E_rest_GeV
+      <<std::setw(w)<< task.spinTune
+      <<std::setw(w)<< task.n0(0) <<std::setw(w)<< task.n0(2) <<std::setw(w)<< task.n0(1) << std::endl;
+  }
+  return s.str();
+}
+
+
+void SpinTuneSolver::save() const
+{
+  std::string filename = (config->outpath()/"spintune.dat").string();
+  std::ofstream file(filename);
+  if (!file.is_open())
+    throw std::runtime_error("Cannot open " + filename);
+  file << config->metadata();
+  file << "# invariant spin axis n0 (at lattice begin) and fractional spin tune from one-turn spin map on closed orbit" << std::endl;
+  file << print();
+  file.close();
+  std::cout << "* Wrote " << filename << std::endl;
+}
@@ -0,0 +1,69 @@
+/* SpinTuneSolver Classes
+ * invariant spin axis n0 and spin tune on the closed orbit from the one-turn spin map.
+ * The one-turn map is the product of the spin rotations of all lattice elements
+ * (as in TrackingTask::matrixTracking() with trajectoryModel closed orbit).
+ * A scan over energy is parallelized by the thread pool (one task per energy).
+ *
+ * Copyright (C) 2017 Jan Felix Schmidt <janschmidt@mailbox.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __POLEMATRIX__SPINTUNESOLVER_HPP_
+#define __POLEMATRIX__SPINTUNESOLVER_HPP_
+
+#include <string>
+#include <vector>
+#define ARMA_NO_DEBUG
+#include <armadillo>
+#include "Simulation.hpp"
+
+
+// one-turn spin map at a single energy (given as agamma)
+class SpinTuneTask : public SingleParticleSimulation {
+protected:
+  bool done;
+
+public:
+  const double agamma;
+  arma::mat33 oneTurnMap;   // at begin of lattice
+  arma::colvec3 n0;         // invariant spin axis (x,s,z), oriented parallel to the sum of all fields
+  double spinTune;          // fractional spin tune [0,1): precession angle around n0 per turn / 2pi
+
+  SpinTuneTask(unsigned int id, const std::shared_ptr<Configuration> c, double a);
+  SpinTuneTask(const SpinTuneTask& other) = delete;
+  SpinTuneTask(SpinTuneTask&& other) = default;
+
+  void run();
+  double getProgress() const {return done ? 1. : 0.;}
+
+  // invariant axis n & fractional spin tune of one-turn map M. n is oriented parallel to guideField
+  static void invariantAxis(const arma::mat33 &M, const arma::colvec3 &guideField, arma::colvec3 &n, double &tune);
+};
+
+
+// solve spin tune & n0 for all energies of the resonance strengths spin tune grid (agammaGrid())
+class SpinTuneSolver : public Simulation<SpinTuneTask> {
+public:
+  SpinTuneSolver(const std::shared_ptr<Configuration> c, unsigned int nThreads=std::thread::hardware_concurrency());
+  SpinTuneSolver(const SpinTuneSolver& o) = delete;
+
+  void start();
+  std::string print() const;
+  void save() const;
+};
+
+
+#endif
+// __POLEMATRIX__SPINTUNESOLVER_HPP_
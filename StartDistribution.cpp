@@ -0,0 +1,105 @@
+/* StartDistribution Class
+ * uniform numbers in [0,1) for the start coordinates of one particle (one number per dimension),
+ * transformed to the start distributions of LongitudinalPhaseSpaceModel and Oscillation.
+ * Variance reduction: quasi-random sampling uses one point of a low-discrepancy sequence
+ * (Halton or Sobol) per particle. With antithetic pairs particles 2k and 2k+1 use the same
+ * point, mirrored for particle 2k+1 (u -> 1-u, phases shifted by pi).
+ * The points of all particles are generated once per simulation (StartSequence).
+ *
+ * Copyright (C) 2017 Jan Felix Schmidt <janschmidt@mailbox.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cmath>
+#include <algorithm>
+#include <gsl/gsl_qrng.h>
+#include <gsl/gsl_cdf.h>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_real_distribution.hpp>
+#include "StartDistribution.hpp"
+
+const double edge = 1e-12; // u is kept away from 0 and 1 for inverse cdf
+
+
+// the first point of the sequence (0 for Sobol) is not used
+static gsl_qrng* allocSequence(const Configuration &config)
+{
+  gsl_qrng *q = gsl_qrng_alloc(config.sampling()==Sampling::sobol ? gsl_qrng_sobol : gsl_qrng_halton, StartDistribution::numDimensions);
+  double u[StartDistribution::numDimensions];
+  gsl_qrng_get(q, u);
+  return q;
+}
+
+
+// quasi-random: point i of the sequence is taken from sequence, if available,
+// otherwise it is generated by skipping all previous points
+StartDistribution::StartDistribution(const Configuration &config, unsigned int particleId, const StartSequence *sequence)
+{
+  unsigned int point = StartDistribution::point(config, particleId);
+  bool mirror = config.antithetic() && particleId%2 == 1;
+
+  if (config.sampling() == Sampling::random) {
+    boost::random::mt11213b rng(config.seed()+point);
+    boost::random::uniform_real_distribution<> distr(0.0, 1.0);
+    for (unsigned int d=0; d<numDimensions; d++)
+      u[d] = distr(rng);
+  }
+  else if (sequence && point < sequence->size()) {
+    std::copy(sequence->point(point), sequence->point(point)+numDimensions, u);
+  }
+  else {
+    gsl_qrng *q = allocSequence(config);
+    for (unsigned int i=0; i<=point; i++)
+      gsl_qrng_get(q, u);
+    gsl_qrng_free(q);
+  }
+
+  if (mirror) {
+    for (unsigned int d=0; d<numDimensions; d++) {
+      if (circular(Dimension(d)))
+	u[d] = std::fmod(u[d]+0.5, 1.);
+      else
+	u[d] = 1. - u[d];
+    }
+  }
+}
+
+
+// points for all particles in one pass
+StartSequence::StartSequence(const Configuration &config)
+{
+  if (!used(config) || config.nParticles() == 0)
+    return;
+  unsigned int n = StartDistribution::point(config, config.nParticles()-1) + 1;
+  u.resize(std::size_t(n) * StartDistribution::numDimensions);
+  gsl_qrng *q = allocSequence(config);
+  for (unsigned int i=0; i<n; i++)
+    gsl_qrng_get(q, &u[std::size_t(i)*StartDistribution::numDimensions]);
+  gsl_qrng_free(q);
+}
+
+
+double StartDistribution::normal(Dimension d, double mean, double sigma) const
+{
+  double x = std::min(std::max(u[d], edge), 1.-edge);
+  return mean + sigma * gsl_cdf_ugaussian_Pinv(x);
+}
+
+
+double StartDistribution::halfNormal(Dimension d, double sigma) const
+{
+  double x = std::min(std::max(0.5+0.5*u[d], 0.5), 1.-edge);
+  return sigma * gsl_cdf_ugaussian_Pinv(x);
+}
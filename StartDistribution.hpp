@@ -0,0 +1,77 @@
+/* StartDistribution Class
+ * uniform numbers in [0,1) for the start coordinates of one particle (one number per dimension),
+ * transformed to the start distributions of LongitudinalPhaseSpaceModel and Oscillation.
+ * Variance reduction: quasi-random sampling uses one point of a low-discrepancy sequence
+ * (Halton or Sobol) per particle. With antithetic pairs particles 2k and 2k+1 use the same
+ * point, mirrored for particle 2k+1 (u -> 1-u, phases shifted by pi).
+ * The points of all particles are generated once per simulation (StartSequence).
+ *
+ * Copyright (C) 2017 Jan Felix Schmidt <janschmidt@mailbox.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __POLEMATRIX__STARTDISTRIBUTION_HPP_
+#define __POLEMATRIX__STARTDISTRIBUTION_HPP_
+
+#include <vector>
+#include "Configuration.hpp"
+
+class StartSequence;
+
+
+class StartDistribution
+{
+public:
+  enum Dimension {synchrotronPhase, energy, emittanceX, emittanceZ, betatronPhaseX, betatronPhaseZ, numDimensions};
+
+protected:
+  double u[numDimensions];
+
+  static bool circular(Dimension d) {return d==betatronPhaseX || d==betatronPhaseZ;}
+
+public:
+  // quasi-random point is taken from sequence. without sequence it is generated (skipping all previous points)
+  StartDistribution(const Configuration &config, unsigned int particleId, const StartSequence *sequence=nullptr);
+
+  // default (random sampling, no antithetic pairs): boost distributions are used as before
+  static bool used(const Configuration &config) {return config.sampling() != Sampling::random || config.antithetic();}
+
+  double uniform(Dimension d, double min, double max) const {return min + u[d]*(max-min);}
+  double normal(Dimension d, double mean, double sigma) const;  // gaussian (inverse cdf)
+  double halfNormal(Dimension d, double sigma) const;           // |gaussian| with mean 0
+
+  // point used by particleId (antithetic pairs share a point)
+  static unsigned int point(const Configuration &config, unsigned int particleId) {return config.antithetic() ? particleId/2 : particleId;}
+};
+
+
+
+// quasi-random points of all particles (config <sampling> sobol/halton), generated once and shared by all tasks
+class StartSequence
+{
+protected:
+  std::vector<double> u; // numDimensions values per point
+
+public:
+  StartSequence(const Configuration &config);
+
+  static bool used(const Configuration &config) {return config.sampling() != Sampling::random;}
+  unsigned int size() const {return u.size() / StartDistribution::numDimensions;}
+  const double* point(unsigned int i) const {return &u[std::size_t(i)*StartDistribution::numDimensions];}
+};
+
+
+#endif
+// __POLEMATRIX__STARTDISTRIBUTION_HPP_
@@ -20,7 +20,9 @@
  */
 
 #include <iostream>
+#include <iomanip>
 #include "Tracking.hpp"
+#include "ResStrengths.hpp" // agammaGrid()
 #include "version.hpp"
 
 
@@ -36,9 +38,24 @@ void Tracking::start()
     throw TrackError(msg.str());
   }
 
-  // fill queue
+  // output elements are resolved once for all particles
+  try {
+    observation->init(*lattice, *config);
+  }
+  catch (std::runtime_error &e) {
+    throw TrackError(e.what());
+  }
+  if (observation->schedule().adaptive())
+    std::cout << "* adaptive output: " << observation->schedule().steps() << " steps (uniform: "
+	      << config->outSteps() << ")" << std::endl;
+
+  if (config->histogramBins() > 0)
+    histograms.reset( new SpinHistograms(observation->schedule().steps(), config->histogramBins()) );
+
+  // fill queue. no reallocation of the queue while threads are running (see stopQueue())
+  queue.reserve(config->nParticles());
   for (unsigned int i=0; i<config->nParticles(); i++) {
-    queue.emplace_back( TrackingTask(i,config) );
+    queue.emplace_back( TrackingTask(i,config,observation) );
   }
   // set iterator to begin of queue
   queueIt = queue.begin();
@@ -52,6 +69,9 @@ void Tracking::start()
   //start threads (incl. progress bars)
   startThreads();
 
+  if (config->convergence())
+    checkConvergence();
+
   waitForThreads();
 
   // finished: calc. time & error output
@@ -70,29 +90,154 @@ void Tracking::start()
 
   if (numSuccessful() > 0)
     calcPolarization();
+  if (config->convergence()) {
+    for (auto &u : unpaired) // antithetic particles without successful partner
+      addSample(u.second);
+    unpaired.clear();
+    calcPolarizationError();
+  }
 }
 
 
+// spins of each successful task are added as soon as it is finished, so they need not be kept
+void Tracking::taskFinished(TrackingTask &task)
+{
+  std::unique_ptr<SpinHistograms> h = task.takeHistograms();
+  std::lock_guard<std::mutex> lock(resultMutex);
+  if (polarization.empty())
+    polarization = task.getStorage();
+  else
+    polarization += task.getStorage();
+  if (histograms && h)
+    *histograms += *h;
+
+  // antithetic pairs (2k,2k+1) are one sample, a particle waits for its partner
+  if (config->convergence()) {
+    if (!config->antithetic()) {
+      addSample(task.getStorage());
+    }
+    else {
+      auto partner = unpaired.find(task.particleId ^ 1u);
+      if (partner == unpaired.end()) {
+	unpaired.emplace(task.particleId, task.getStorage());
+      }
+      else {
+	addSample(task.getStorage(), &partner->second);
+	unpaired.erase(partner);
+      }
+    }
+  }
+  task.releaseStorage();
+  numFinished++;
+  resultAdded.notify_all();
+}
+
+
+// spins of a particle or mean of an antithetic pair (b)
+void Tracking::addSample(const SpinMotion &a, const SpinMotion *b)
+{
+  if (numSamples == 0) {
+    sampleSum.assign(a.size(), arma::colvec3({0.,0.,0.}));
+    sampleSquareSum.assign(a.size(), 0.);
+  }
+  if (a.size() != sampleSum.size() || (b && b->size() != a.size()))
+    throw TrackError("Tracking::addSample(): incompatible tracking time steps");
+
+  unsigned int k = 0;
+  auto itB = b ? b->begin() : a.end();
+  for (auto &step : a) {
+    arma::colvec3 s = step.second;
+    if (b)
+      s = 0.5 * (s + (itB++)->second);
+    sampleSum[k] += s;
+    sampleSquareSum[k] += arma::dot(s, s);
+    k++;
+  }
+  numSamples++;
+}
+
+
+// runs while tracking. the standard error is checked whenever particles are finished.
+// threads continue with further particles during the check, so stopping may track a few more
+void Tracking::checkConvergence()
+{
+  unsigned int checked = 0;
+  std::unique_lock<std::mutex> lock(resultMutex);
+  while (tasksLeft()) {
+    resultAdded.wait_for(lock, std::chrono::seconds(1));
+    if (numFinished == checked || numFinished < std::max(2u, config->convergenceMinParticles()))
+      continue;
+    checked = numFinished;
+    calcPolarizationError();
+    if (polarizationError <= config->convergenceTolerance()) {
+      stopQueue();
+      std::cout << std::endl << "* " << numFinished << " Spins tracked: standard error of polarization "
+		<< polarizationError << " (tolerance " << config->convergenceTolerance() << ")."
+		<< " No further Spins are started." << std::endl;
+      return;
+    }
+  }
+}
 
 
-//calculate polarization: average over all successfully tracked spin vectors for each time step
+//calculate polarization: average over all successfully tracked spin vectors for each time step (summed by taskFinished())
 void Tracking::calcPolarization()
 {
-  unsigned int i=0;
-  for (; i<queue.size(); i++) {
+  polarization /= numSuccessful();
+
+  unsigned int i;
+
+  outputPolarization.assign(observation->size() > 1 ? observation->size()-1 : 0, SpinMotion(config));
+  for (unsigned int k=0; k<outputPolarization.size(); k++) {
+    bool first = true;
+    for (i=0; i<queue.size(); i++) {
+      if (errors.count(i)==0) {
+	if (first)
+	  outputPolarization[k] = queue[i].getOutputStorage()[k];
+	else
+	  outputPolarization[k] += queue[i].getOutputStorage()[k];
+	first = false;
+      }
+    }
+    outputPolarization[k] /= numSuccessful();
+  }
+
+  if (!config->transferMatrix())
+    return;
+  bool first = true;
+  for (i=0; i<queue.size(); i++) {
     if (errors.count(i)==0) {
-      polarization = queue[i].getStorage();
-      break;
+      for (unsigned int j=0; j<3; j++) {
+	if (first)
+	  polarizationMatrix[j] = queue[i].getTransferStorage()[j];
+	else
+	  polarizationMatrix[j] += queue[i].getTransferStorage()[j];
+      }
+      first = false;
     }
   }
+  for (auto &p : polarizationMatrix)
+    p /= numSuccessful();
+}
 
-  for (i++; i<queue.size(); i++) {
-    if (errors.count(i)==0)
-      polarization += queue[i].getStorage();
+// standard error of the mean spin vector for each time step, sqrt( sum_k |s_k - P|^2 / (n(n-1)) )
+// with sum_k |s_k - P|^2 = sum_k |s_k|^2 - n |P|^2. It assumes independent samples s_k:
+// antithetic pairs are combined to one sample. Quasi-random start points (<sampling> halton/sobol)
+// are not independent, the estimate is usually too large for them.
+void Tracking::calcPolarizationError()
+{
+  polarizationError = INFINITY;
+  if (numSamples < 2)
+    return;
+  polarizationError = 0.;
+  double n = numSamples;
+  for (unsigned int k=0; k<sampleSum.size(); k++) {
+    double var = sampleSquareSum[k] - arma::dot(sampleSum[k], sampleSum[k]) / n;
+    polarizationError = std::max(polarizationError, std::sqrt(std::max(0., var) / (n*(n-1))));
   }
-  polarization /= numSuccessful();
 }
 
+
 void Tracking::savePolarization()
 {
   std::ofstream file;
@@ -105,10 +250,182 @@ void Tracking::savePolarization()
 
   file << config->metadata();
   file << "# Polarization calculated as average over " << numSuccessful() << " spins" << std::endl;
+  if (config->convergence())
+    file << "# Standard error of polarization (max. over all steps): " << polarizationError << std::endl;
+  file << observation->schedule().printCrossings();
   file << polarization.printHeader(w, "P") << std::endl;
   file << polarization.print(w);
   
   file.close();
   std::cout << "* Polarization written for " << polarization.size() << " steps to " << filename <<"."<< std::endl;
+
+  // further output elements
+  for (unsigned int k=0; k<outputPolarization.size(); k++) {
+    filename = (config->outpath()/("polarization_" + observation->name(k+1) + ".dat")).string();
+    file.open(filename);
+    if (!file.is_open())
+      throw TrackFileError(filename);
+    file << config->metadata();
+    file << "# Polarization at " << observation->name(k+1) << " calculated as average over " << numSuccessful() << " spins" << std::endl;
+    file << outputPolarization[k].printHeader(w, "P") << std::endl;
+    file << outputPolarization[k].print(w);
+    file.close();
+    std::cout << "* Polarization at " << observation->name(k+1) << " written for " << outputPolarization[k].size()
+	      << " steps to " << filename <<"."<< std::endl;
+  }
+}
+
+
+// averaged transfer matrix: polarization for any start spin s0 is P(t) = sum_j s0_j * P_j(t)
+// with P_j for start spin in direction j=x,s,z
+void Tracking::savePolarizationMatrix()
+{
+  if (!config->transferMatrix() || numSuccessful() == 0)
+    return;
+
+  std::ofstream file;
+  std::string filename = config->polMatrixFile().string();
+  unsigned int w = 14;
+
+  file.open(filename);
+  if (!file.is_open())
+    throw TrackFileError(filename);
+
+  file << config->metadata();
+  file << "# Spin transfer matrix: polarization for start spins x, s, z. Average over " << numSuccessful() << " particles" << std::endl;
+  file << "#"<<std::setw(w+1)<< "t / s";
+  for (std::string start : {"x", "s", "z"}) {
+    for (std::string P : {"Px", "Pz", "Ps"})
+      file <<std::setw(w)<< start+":"+P;
+  }
+  file <<std::setw(w)<< "E0 / GeV" << std::endl;
+
+  auto it0 = polarizationMatrix[0].begin();
+  auto it1 = polarizationMatrix[1].begin();
+  auto it2 = polarizationMatrix[2].begin();
+  for (; it0 != polarizationMatrix[0].end(); ++it0, ++it1, ++it2) {
+    file << std::resetiosflags(std::ios::fixed)<<std::setiosflags(std::ios::scientific)
+	 <<std::showpoint<<std::setprecision(8)<<std::setw(w+2)<< it0->first
+	 <<std::resetiosflags(std::ios::scientific)<<std::setiosflags(std::ios::fixed)<<std::setprecision(5);
+    for (auto &P : {it0->second, it1->second, it2->second})
+      file <<std::setw(w)<< P[0] <<std::setw(w)<< P[2] <<std::setw(w)<< P[1];
+    file <<std::setw(w)<< config->E_GeV(it0->first) << std::endl;
+  }
+  file.close();
+  std::cout << "* Spin transfer matrix written for " << polarizationMatrix[0].size() << " steps to " << filename <<"."<< std::endl;
+}
+
+
+// time of step i from polarization, from output schedule for steps without polarization
+void Tracking::saveHistograms()
+{
+  if (!histograms)
+    return;
+
+  std::vector<double> t;
+  for (auto &step : polarization)
+    t.push_back(step.first);
+  while (t.size() < histograms->steps())
+    t.push_back(observation->schedule().time(t.size()));
+
+  std::ofstream file;
+  std::string filename = (config->outpath()/"spin-histograms.dat").string();
+  file.open(filename);
+  if (!file.is_open())
+    throw TrackFileError(filename);
+
+  file << config->metadata();
+  file << "# Histograms of spin distribution of " << numSuccessful() << " particles for each output step" << std::endl;
+  file << observation->schedule().printCrossings();
+  file << histograms->print(t);
+  file.close();
+  std::cout << "* Spin histograms written to " << filename <<"."<< std::endl;
+}
+
+
+// power spectra averaged over successful particles, one line per window
+void Tracking::saveSpectrum()
+{
+  if (!config->spectrum())
+    return;
+
+  std::map<double,std::vector<double>> mean;
+  unsigned int n = 0;
+  for (unsigned int i=0; i<queue.size(); i++) {
+    if (errors.count(i) > 0)
+      continue;
+    n++;
+    for (auto &window : queue[i].getSpectrum().get()) {
+      std::vector<double> &m = mean[window.first];
+      m.resize(window.second.size(), 0.);
+      for (unsigned int k=0; k<m.size(); k++)
+	m[k] += window.second[k];
+    }
+  }
+  if (n == 0)
+    return;
+
+  std::ofstream file;
+  std::string filename = (config->outpath()/"spin-spectrum.dat").string();
+  unsigned int w = 14;
+  file.open(filename);
+  if (!file.is_open())
+    throw TrackFileError(filename);
+
+  file << config->metadata();
+  file << "# Spectrum of spin precession Sx+-i*Ss (sign of vertical guide field) averaged over " << n << " spins: " << config->spectrumWindow()
+       << " samples per window (Hann), one sample every " << config->spectrumSampling() << " turns" << std::endl;
+  file << "# frequency of bin k is k/" << config->spectrumBins() << " per sample,"
+       << " peak frequency is fractional spin tune (times samples per turn, modulo 1)" << std::endl;
+  file << "#"<<std::setw(w)<< "t / s" <<std::setw(w)<< "peak freq." << "  power per bin" << std::endl;
+  for (auto &window : mean) {
+    file << std::resetiosflags(std::ios::fixed)<<std::setiosflags(std::ios::scientific)
+	 <<std::showpoint<<std::setprecision(8)<<std::setw(w+1)<< window.first;
+    for (auto &p : window.second)
+      p /= n;
+    file <<std::setw(w)<< SpinSpectrum::peak(window.second) << " ";
+    for (auto &p : window.second)
+      file << " " << p;
+    file << std::endl;
+  }
+  file.close();
+  std::cout << "* Spin spectrum written for " << mean.size() << " windows to " << filename <<"."<< std::endl;
 }
 
+
+// same format as resonance strengths mode (ResStrengths::print())
+void Tracking::saveResStrengths()
+{
+  if (!config->trackResStrengths() || numSuccessful() == 0)
+    return;
+
+  std::vector<double> agammas = agammaGrid(*config);
+  std::vector<std::complex<double>> epsilon(agammas.size(), std::complex<double>(0,0));
+  for (unsigned int i=0; i<queue.size(); i++) {
+    if (errors.count(i)==0) {
+      const std::vector<std::complex<double>> &e = queue[i].getResStrengths();
+      for (unsigned int k=0; k<epsilon.size() && k<e.size(); k++)
+	epsilon[k] += e[k];
+    }
+  }
+
+  std::ofstream file;
+  std::string filename = (config->outpath()/"resonance-strengths.dat").string();
+  const unsigned int w = 16;
+  file.open(filename);
+  if (!file.is_open())
+    throw TrackFileError(filename);
+
+  file << config->metadata();
+  file << "# Resonance strengths from tracked fields, average over " << numSuccessful() << " particles" << std::endl;
+  file << "#"<<std::setw(w)<<"agamma"<<std::setw(w)<< "real(epsilon)" <<std::setw(w)<< "imag(epsilon)" <<std::setw(w)<< "abs(epsilon)" << std::endl;
+  for (unsigned int k=0; k<agammas.size(); k++) {
+    std::complex<double> e = epsilon[k] / double(numSuccessful());
+    file <<resetiosflags(std::ios::scientific)<<setiosflags(std::ios::fixed)<<std::setprecision(4);
+    file <<std::setw(1+w)<< agammas[k];
+    file <<resetiosflags(std::ios::fixed)<<setiosflags(std::ios::scientific)<<std::showpoint<<std::setprecision(5);
+    file <<std::setw(w)<< e.real() <<std::setw(w)<< e.imag() <<std::setw(w)<< std::abs(e) << std::endl;
+  }
+  file.close();
+  std::cout << "* Resonance strengths written for " << agammas.size() << " spin tunes to " << filename <<"."<< std::endl;
+}
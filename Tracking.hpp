@@ -24,6 +24,7 @@
 
 #include <thread>
 #include <mutex>
+#include <condition_variable>
 #include <memory>
 #include "Simulation.hpp"
 #include "TrackingTask.hpp"
@@ -32,22 +33,46 @@
 class Tracking : public Simulation<TrackingTask>
 {
 private:
-  SpinMotion polarization;
+  SpinMotion polarization;  // sum of spins of finished tasks while tracking, average afterwards
+  std::vector<SpinMotion> polarizationMatrix; // for start spins x,s,z (config <transferMatrix>)
+  std::vector<SpinMotion> outputPolarization; // at further output elements (config <outElement> list)
+  std::shared_ptr<ObservationPoints> observation;
+  std::unique_ptr<SpinHistograms> histograms;   // spin distribution of successful particles (config <histogramBins>)
+  double polarizationError; // standard error of polarization, max. over all time steps (config <convergence>)
+  std::mutex resultMutex;   // results of finished tasks are merged by their threads
+  std::condition_variable resultAdded;
+  unsigned int numFinished; // successful particles merged so far
+
+  // standard error (config <convergence>): sums over independent samples (particle or antithetic pair) per step
+  std::vector<arma::colvec3> sampleSum;
+  std::vector<double> sampleSquareSum;
+  unsigned int numSamples;
+  std::map<unsigned int,SpinMotion> unpaired; // antithetic particles waiting for their partner
+
+  void taskFinished(TrackingTask &task); // add spins to polarization, histograms & samples
+  void addSample(const SpinMotion &a, const SpinMotion *b=nullptr);
+  void checkConvergence();  // stop queue, when standard error is small enough
   void calcPolarization();  //calculate polarization: average over all spin vectors for each time step
+  void calcPolarizationError();
 
 
 public:
-  Tracking(unsigned int nThreads=std::thread::hardware_concurrency()) : Simulation(nThreads), polarization(config) {}
+  Tracking(unsigned int nThreads=std::thread::hardware_concurrency())
+    : Simulation(nThreads), polarization(config), polarizationMatrix(3, SpinMotion(config)),
+      observation(new ObservationPoints), polarizationError(0.), numFinished(0), numSamples(0) {}
   Tracking(const Tracking& o) = delete;
   ~Tracking() {}
   
   void start();                  // start tracking (processing queued tasks)
 
-  unsigned int numParticles() const {return config->nParticles();}
   unsigned int numThreads() const {return threadPool.size();} // number of threads (particle trackings) executed in parallel
 
   const SpinMotion getPolarization() const {return polarization;}
   void savePolarization();
+  void savePolarizationMatrix();
+  void saveHistograms();
+  void saveSpectrum();         // average over particles (config spintracking <spectrum>)
+  void saveResStrengths();     // average over particles (config spintracking <resonanceStrengths>)
 };
 
 
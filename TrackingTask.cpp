@@ -21,8 +21,10 @@
 #include <iomanip>
 #include <cmath>
 #include <stdexcept>
+#include <algorithm>
 #include <gsl/gsl_spline.h>
 #include "TrackingTask.hpp"
+#include "ResStrengths.hpp" // agammaGrid()
 
 
 
@@ -103,11 +105,14 @@ std::string SpinMotion::printAnyData(unsigned int w, const double &t, const arma
 
 
 
-TrackingTask::TrackingTask(unsigned int id, const std::shared_ptr<Configuration> c)
-  : SingleParticleSimulation(id,c), storage(config), w(14), completed(false),
-    gammaSimTool(config->getSimToolInstance(), gsl_interp_akima),
-    syliModel(config->seed()+particleId, config),
-    currentElement(pal::AccLattice().begin())
+TrackingTask::TrackingTask(unsigned int id, const std::shared_ptr<Configuration> c, std::shared_ptr<const ObservationPoints> o)
+  : SingleParticleSimulation(id,c), storage(config), observation(o),
+    outputStorage(o->size() > 1 ? o->size()-1 : 0, SpinMotion(c)),
+    spectrum(config->spectrum() ? SpinSpectrum(config->spectrumWindow(), config->spectrumSampling(), config->spectrumBins()) : SpinSpectrum()),
+    transferStorage(3, SpinMotion(c)), w(14), completed(false),
+    syliModel(config->seed()+particleId, config, particleId), gammaDeviation(0.),
+    synchrotronWavenumber(0.), synchrotronPhasorValid(false), linearFieldDeviation(0.),
+    currentElement(pal::AccLattice().begin()), currentIndex(0)
     // pal::AccLattice::const_iterator currentElement is initialized with empty lattice (dirty)!
 {
   one.eye(); // fill unit matrix
@@ -145,6 +150,8 @@ void TrackingTask::run()
 {
   initGamma();
   trajectory->init();
+  if (config->histogramBins() > 0) // allocated while running only, taken by Tracking afterwards
+    histograms.reset( new SpinHistograms(observation->schedule().steps(), config->histogramBins()) );
   
   outfileOpen();
 
@@ -154,7 +161,8 @@ void TrackingTask::run()
   outfileClose();
 
   // clear interpolation to save memory
-  gammaSimTool.clear();
+  gammaSimTool.reset();
+  gammaCompact.clear();
   trajectory->clear();
   
   completed = true;
@@ -166,35 +174,87 @@ void TrackingTask::initGamma()
        || config->gammaMode()==GammaMode::simtool_plus_linear
        || config->gammaMode()==GammaMode::simtool_no_interpolation )
     {
-      // simtool: sdds import thread safe since SDDSToolKit-devel-3.3.1-2
-      std::string col;
-      if (config->getSimToolInstance().tool==elegant) {
-	col = "p";
-      }
-      else if (config->getSimToolInstance().tool==madx) {
-	std::cout << "WARNING: It is recommended to use elegant for gammaModel simtool." << std::endl;
-	col = "PT";
-      }
-      gammaSimTool.readSimToolParticleColumn( config->getSimToolInstance(), particleId+1, col );
+      if (!simToolStore)
+	throw TrackError("TrackingTask::initGamma(): no SimToolStore set");
+      SimToolStore::GammaSamples g = simToolStore->takeGamma(particleId);
+      gammaSimTool = g.full;
+      gammaCompact = std::move(g.compact);
+      if (!gammaCompact.empty())
+	gammaSampling = simToolStore->sampling();
       gammaSimToolCentral = config->getSimToolInstance().readGammaCentral();
-      if (config->getSimToolInstance().tool==madx) { // madx: PT is dE/E -> gamma=(PT+1)*gamma0
-	gammaSimTool += 1.;
-	gammaSimTool *= gammaSimToolCentral;
-      }
-      if (config->gammaMode() != GammaMode::simtool_no_interpolation) {
-	    gammaSimTool.init();
-      }
-      saveGammaSimTool();
     }
   else if ( config->gammaMode()==GammaMode::radiation
 	    || config->gammaMode()==GammaMode::offset
 	    || config->gammaMode()==GammaMode::oscillation ) {
-    syliModel.init(lattice);
+    syliModel.init(lattice, startSequence);
+    gammaDeviation = syliModel.gammaMinusGamma0();
+    if (config->gammaMode()==GammaMode::oscillation)
+      initSynchrotronPhasor();
   }
   //else: no init needed
 }
 
 
+double TrackingTask::gammaFromSimTool(const double &pos)
+{
+  if (gammaCompact.empty())
+    return gammaSimTool->interpPeriodic(pos-config->pos_start());
+  double w;
+  std::size_t i = gammaSampling.locate(pos, w);
+  return gammaCompact.interp(i, w);
+}
+
+
+// compact storage: samples are at elements, so the nearest one is the value at the current element
+double TrackingTask::gammaFromSimToolNoInterpolation(const double &pos)
+{
+  if (gammaCompact.empty())
+    return gammaSimTool->infrontof(pos-config->pos_start());
+  double w;
+  std::size_t i = gammaSampling.locate(pos, w);
+  return gammaCompact[ (w < 0.5) ? i : i+1 ];
+}
+
+
+// deviation of linearized field from full field calculation of current element
+void TrackingTask::checkLinearField(const pal::AccTriple &linear, const pal::AccPair &traj)
+{
+  pal::AccTriple full = currentElement.element()->B_int(traj);
+  double deviation = std::max({std::fabs(linear.x-full.x), std::fabs(linear.z-full.z), std::fabs(linear.s-full.s)});
+  if (deviation > linearFieldDeviation) {
+    linearFieldDeviation = deviation;
+    linearFieldDeviationElement = currentElement.element()->name;
+  }
+}
+
+
+// synchrotron frequency is constant for gammaMode "oscillation" (gamma & gamma0 of syliModel are not updated),
+// so the phase advance between two elements is the same on every turn
+void TrackingTask::initSynchrotronPhasor()
+{
+  synchrotronWavenumber = 2*M_PI*syliModel.synchrotronFreq_current()/GSL_CONST_MKSA_SPEED_OF_LIGHT;
+  synchrotronStep.clear();
+  synchrotronStep.reserve(lattice->size());
+  for (auto it=lattice->begin(); it!=lattice->end(); ++it) {
+    synchrotronStep.push_back( std::polar(1., synchrotronWavenumber*it.distanceNext()) );
+  }
+  synchrotronPhasorValid = false;
+}
+
+
+// index of element in lattice (counted from lattice->begin())
+unsigned int TrackingTask::elementIndex(const pal::AccLattice::const_iterator &element) const
+{
+  unsigned int i=0;
+  for (auto it=lattice->begin(); it!=lattice->end(); ++it) {
+    if (it == element)
+      return i;
+    i++;
+  }
+  throw TrackError("TrackingTask::elementIndex(): element not found in lattice");
+}
+
+
 
 void TrackingTask::matrixTracking()
 {
@@ -202,36 +262,71 @@ void TrackingTask::matrixTracking()
   pal::AccTriple omega;
   double pos = config->pos_start();
   double pos_stop = config->pos_stop();
-  double dpos_out = config->dpos_out();
-  double pos_nextOut = pos;
+  const OutputSchedule &schedule = observation->schedule();
+  std::vector<unsigned int> nextOut(std::max(1u, observation->size()), 0); // next output step
+  double guideField = 0.; // sum of vertical fields, orientation of spin precession (config <spectrum>)
 
   // set start lattice element and position
   currentElement = lattice->behind( orbit->posInTurn(pos), pal::Anchor::end );
+  currentIndex = elementIndex(currentElement);
   pos = (orbit->turn(pos)-1)*lattice->circumference() + currentElement.pos();
+  if (config->trackResStrengths())
+    initResStrengths();
+  transfer = one;
 
   while (pos < pos_stop) {
     currentGamma = (this->*gamma)(pos);
-    auto rf = currentElement.element()->rfFactor(orbit->turn(pos));
-    auto Bint = currentElement.element()->B_int( trajectory->get(pos) ) * rf;  // field of element
-    // Dipole: Integral field including Bx from edge focussing (! uses vertical trajectory at "pos" for magnet entrance and exit)
-    if (config->edgefoc() && currentElement.element()->type == pal::dipole) {
-      Bint.x -= ( tan(currentElement.element()->e1) + tan(currentElement.element()->e2) )/(1./currentElement.element()->k0.z) * trajectory->get(pos).z;
+    double rf = rfMagnetFactor(pos);
+    pal::AccTriple Bint;  // field of element
+    if (elementFields && elementFields->hasOrbit()) {
+      Bint = elementFields->Bint(currentIndex) * rf;
+      Bint.x += elementFields->edgeBx(currentIndex);
+    }
+    else {
+      pal::AccPair traj = trajectory->get(pos);
+      if (elementFields && elementFields->hasLinear() && elementFields->linear(currentIndex)) {
+	Bint = elementFields->Bint(currentIndex, traj);
+	if (config->linearFieldsCheck())
+	  checkLinearField(Bint, traj);
+	Bint = Bint * rf;
+      }
+      else {
+	Bint = currentElement.element()->B_int(traj) * rf;
+      }
+      // Dipole: Integral field including Bx from edge focussing
+      if (config->edgefoc() && currentElement.element()->type == pal::dipole) {
+	Bint.x += ElementFields::edgeBx(currentElement.element(), traj.z);
+      }
     }
+    if (config->trackResStrengths())
+      addResStrengths(Bint, pos);
+    guideField += Bint.z;
     omega = Bint * config->a_gyro;
     omega.x *= currentGamma;
     omega.z *= currentGamma;
     // omega.s: Precession around s is suppressed by factor gamma (->TBMT-equation)
 
     // spin rotation
-    s = rotMatrix(omega) * s;
+    if (config->transferMatrix()) {
+      arma::mat33 rot = rotMatrix(omega);
+      s = rot * s;
+      transfer = rot * transfer;
+    }
+    else {
+      s = rotMatrix(omega) * s;
+    }
 
-    // output
-    if (pos >= pos_nextOut) {
-      if (!config->outElementUsed() || currentElement.element()->name == config->outElement()) {
+    // output (first output element or any element: spin output file & polarization)
+    int out = observation->output(currentIndex);
+    if (out >= 0 && pos >= schedule.pos(nextOut[out])) {
+      if (out == 0) {
 	checkLongStability();
-	storeStep(pos,s);
-	pos_nextOut += dpos_out;
+	storeStep(nextOut[out],pos,s);
       }
+      else {
+	outputStorage[out-1].insert(std::pair<double,arma::colvec3>(pos/GSL_CONST_MKSA_SPEED_OF_LIGHT,s));
+      }
+      nextOut[out]++;
     }
     gammaStat(currentGamma);
 
@@ -240,9 +335,70 @@ void TrackingTask::matrixTracking()
     // step to next element
     pos += currentElement.distanceNext();
     currentElement.revolve();
+    if (++currentIndex == lattice->size()) {
+      currentIndex = 0;
+      if (config->spectrum())
+	spectrum.addTurn(pos/GSL_CONST_MKSA_SPEED_OF_LIGHT, s, guideField);
+    }
+  }
+
+  if (config->trackResStrengths())
+    finishResStrengths( (pos_stop-config->pos_start())/lattice->circumference() );
+}
+
+
+// res. strengths from the fields used for spin rotation, see ParticleResStrengths::sampleFields().
+// unlike resonance strengths mode, rf magnets & edge focussing (if enabled) are included
+void TrackingTask::initResStrengths()
+{
+  elementTheta.resize(lattice->size());
+  dipoleAngle.assign(lattice->size(), 0.);
+  unsigned int i = 0;
+  for (auto it=lattice->begin(); it!=lattice->end(); ++it, i++) {
+    if (it.element()->type == pal::dipole) {
+      elementTheta[i] = lattice->theta(it.begin());
+      dipoleAngle[i] = lattice->theta(it.end()) - elementTheta[i];
+    }
+    else {
+      elementTheta[i] = lattice->theta(it.pos());
+    }
+  }
+  unsigned int n = agammaGrid(*config).size();
+  resStrengthSums.init(config->agammaMin(), config->dagamma(), n, config->nufft() ? config->nufftTolerance() : 0.);
+}
+
+// dipole: B*R * (e^{i*agamma*theta2}-e^{i*agamma*theta1}) / (i*agamma) with B*R = B_int/angle
+void TrackingTask::addResStrengths(const pal::AccTriple &Bint, const double &pos)
+{
+  double theta = elementTheta[currentIndex] + 2*M_PI*(orbit->turn(pos)-1);
+  double angle = dipoleAngle[currentIndex];
+  if (angle != 0.) {
+    resStrengthSums.addDipole(theta+angle, Bint.x/angle, Bint.s/angle);
+    resStrengthSums.addDipole(theta, -Bint.x/angle, -Bint.s/angle);
+  }
+  else {
+    resStrengthSums.addElement(theta, Bint.x, Bint.s);
   }
 }
 
+void TrackingTask::finishResStrengths(double turns)
+{
+  resStrengthSums.flush();
+  resStrengths.resize(resStrengthSums.size());
+  for (unsigned int k=0; k<resStrengths.size(); k++)
+    resStrengths[k] = resStrengthSums.epsilon(k, config->a_gyro) / turns;
+  resStrengthSums.init(0., 0., 0); // free buffers
+}
+
+// factor of rf magnet field. ordinary elements (known from ElementFields): 1 without calculation.
+// rf magnets are passed once per turn, so their factor is calculated by palattice at each pass
+double TrackingTask::rfMagnetFactor(const double &pos)
+{
+  if (elementFields && elementFields->hasRf() && elementFields->rfMagnet(currentIndex) < 0)
+    return 1.;
+  return currentElement.element()->rfFactor(orbit->turn(pos));
+}
+
 arma::mat33 TrackingTask::rotxMatrix(double angle) const
 {
   double c=std::cos(angle);
@@ -253,11 +409,15 @@ arma::mat33 TrackingTask::rotxMatrix(double angle) const
 }
 
 
-arma::mat33 TrackingTask::rotMatrix(pal::AccTriple B_in) const
+arma::mat33 TrackingTask::rotMatrix(pal::AccTriple B_in)
 {
   arma::colvec3 B = {B_in.x,B_in.s,B_in.z};
   double angle = std::sqrt(std::pow(B(0),2) + std::pow(B(1),2) + std::pow(B(2),2)); //faster than arma::norm(B);
-  if (angle < MIN_AMPLITUDE) return one;
+  if (angle < MIN_AMPLITUDE) {
+    arma::mat33 unit;
+    unit.eye();
+    return unit;
+  }
 
   arma::colvec3 n = B/angle; //faster than arma::normalise(B)
 
@@ -282,20 +442,6 @@ void TrackingTask::checkLongStability() const
 }
 
 
-void TrackingTask::saveGammaSimTool()
-{
-  if ( !config->saveGamma(particleId) )
-    return;
-  
-  gammaSimTool.info.add("polematrix particle ID", particleId);
-  std::stringstream file;
-  file <<std::setw(4)<<std::setfill('0')<< particleId << ".dat";
-  gammaSimTool.print( (config->outpath()/"gammaSimTool_").string() + file.str() );
-
-  trajectory->saveSimtoolData();
-}
-
-
 std::string TrackingTask::outfileName() const
 {
   std::stringstream ss;
@@ -314,20 +460,22 @@ std::string TrackingTask::phasespaceOutfileName() const
 
 void TrackingTask::outfileOpen()
 {
-  if ( fs::create_directory(config->spinDirectory()) )
-       std::cout << "* created directory " << config->spinDirectory() << std::endl;
-  outfile->open(outfileName());
-  if (!outfile->is_open())
-    throw TrackFileError(outfileName());
-
-  *outfile << config->metadata();
-
-  // table header line
-  *outfile << storage.printHeader(w) <<std::setw(w)<< "gamma";
-  if (config->gammaMode() == GammaMode::radiation) {
-    *outfile <<std::setw(w)<< "phase / rad";
+  if (config->spinFiles()) {
+    if ( fs::create_directory(config->spinDirectory()) )
+      std::cout << "* created directory " << config->spinDirectory() << std::endl;
+    outfile->open(outfileName());
+    if (!outfile->is_open())
+      throw TrackFileError(outfileName());
+
+    *outfile << config->metadata();
+
+    // table header line
+    *outfile << storage.printHeader(w) <<std::setw(w)<< "gamma";
+    if (config->gammaMode() == GammaMode::radiation) {
+      *outfile <<std::setw(w)<< "phase / rad";
+    }
+    *outfile << std::endl;
   }
-  *outfile << std::endl;
 
   // additional output file for phase space, if activated in config
   if (config->gammaMode()==GammaMode::radiation && config->savePhaseSpace(particleId)) {
@@ -344,14 +492,22 @@ void TrackingTask::outfileOpen()
 
 void TrackingTask::outfileClose()
 {
-  *outfile << "# gamma statistics:" << std::endl
-	   << "# mean:  " << gammaStat.mean() << std::endl
-	   << "# stddev: " << gammaStat.stddev(1) << std::endl;
-    
-  outfile->close();
-  if (config->verbose()) {
-    std::cout << "* " << storage.size() << " steps written to " << outfileName()
-	      <<std::setw(40)<<std::left<< "." << std::endl;
+  if (outfile->is_open()) {
+    *outfile << "# gamma statistics:" << std::endl
+	     << "# mean:  " << gammaStat.mean() << std::endl
+	     << "# stddev: " << gammaStat.stddev(1) << std::endl;
+    if (config->linearFieldsCheck() && elementFields && elementFields->hasLinear()) {
+      *outfile << "# linearized fields: max. deviation of B_int: " << linearFieldDeviation;
+      if (!linearFieldDeviationElement.empty())
+	*outfile << " at " << linearFieldDeviationElement;
+      *outfile << std::endl;
+    }
+
+    outfile->close();
+    if (config->verbose()) {
+      std::cout << "* " << storage.size() << " steps written to " << outfileName()
+		<<std::setw(40)<<std::left<< "." << std::endl;
+    }
   }
 
   if (outfile_ps->is_open()) {
@@ -363,6 +519,8 @@ void TrackingTask::outfileClose()
 
 void TrackingTask::outfileAdd(const double &t, const arma::colvec3 &s)
 {
+  if (!outfile->is_open())
+    return;
   *outfile << storage.printAnyData(w,t,s) << std::setw(w)<< currentGamma;
   if (config->gammaMode() == GammaMode::radiation)
     *outfile <<std::setw(w)<< syliModel.phase();
@@ -379,20 +537,28 @@ void TrackingTask::outfileAdd_ps(const double &pos)
 
 
 
-void TrackingTask::storeStep(const double &pos, const arma::colvec3 &s)
+void TrackingTask::storeStep(unsigned int step, const double &pos, const arma::colvec3 &s)
 {
   double t = pos/GSL_CONST_MKSA_SPEED_OF_LIGHT;
   storage.insert(std::pair<double,arma::colvec3>(t,s));
+  if (histograms)
+    histograms->add(step, s);
+  if (config->transferMatrix()) {
+    for (unsigned int j=0; j<3; j++)
+      transferStorage[j].insert(std::pair<double,arma::colvec3>(t,transfer.col(j)));
+  }
   outfileAdd(t,s);
 }
 
 
 
 
+
+
 double TrackingTask::gammaRadiation(const double &pos)
 {
   // long. phase space output
-  if (config->savePhaseSpace(particleId) && currentElement.element()->name == config->savePhaseSpaceElement()) {
+  if (observation->phaseSpace(currentIndex) && outfile_ps->is_open()) {
     outfileAdd_ps(pos);
   }
   
@@ -400,3 +566,16 @@ double TrackingTask::gammaRadiation(const double &pos)
   return syliModel.gamma();
 }
 
+
+// uses particleId for individual start phases
+double TrackingTask::gammaOscillation(const double &pos)
+{
+  // exact phase at start and once per turn avoids accumulation of rounding errors
+  if (!synchrotronPhasorValid || currentIndex == 0) {
+    synchrotronPhasor = std::polar(1., synchrotronWavenumber*pos + particleId);
+    synchrotronPhasorValid = true;
+  }
+  double g = gammaFromConfig(pos) + gammaDeviation*synchrotronPhasor.real();
+  synchrotronPhasor *= synchrotronStep[currentIndex];
+  return g;
+}
@@ -25,6 +25,8 @@
 #include <map>
 #include <memory>
 #include <functional>
+#include <complex>
+#include <vector>
 #define ARMA_NO_DEBUG
 #include <armadillo>
 #include <libpalattice/AccLattice.hpp>
@@ -33,6 +35,11 @@
 #include "Simulation.hpp"
 #include "RadiationModel.hpp"
 #include "Trajectory.hpp"
+#include "CompactSamples.hpp"
+#include "ResonanceSums.hpp"
+#include "ObservationPoints.hpp"
+#include "SpinSpectrum.hpp"
+#include "SpinHistograms.hpp"
 
 
 // spin tracking result container (3d spin vector as function of time)
@@ -61,16 +68,42 @@ class TrackingTask : public SingleParticleSimulation
 private:
   arma::mat33 one;
   SpinMotion storage;                         // store results
+  std::shared_ptr<const ObservationPoints> observation; // output elements
+  std::vector<SpinMotion> outputStorage;      // results at further output elements (config <outElement> list)
+  SpinSpectrum spectrum;                      // spin precession spectrum (config <spectrum>)
+  std::unique_ptr<SpinHistograms> histograms; // spin distribution per output step (config <histogramBins>)
+  arma::mat33 transfer;                       // spin transfer matrix from start (config <transferMatrix>)
+  std::vector<SpinMotion> transferStorage;    // its columns: spins for start spins x,s,z
   std::unique_ptr<std::ofstream> outfile;     // output file via pointer, std::ofstream not moveable in gcc 4.9
   std::unique_ptr<std::ofstream> outfile_ps;  // output file for long. phase space (gammaMode radiation only)
   unsigned int w;                             // output column width (print)
   bool completed;                             // tracking completed
-  pal::FunctionOfPos<double> gammaSimTool;    // gamma(pos) from elegant
+  std::shared_ptr<SimToolStore::GammaData> gammaSimTool; // gamma(pos) from elegant, taken from SimToolStore
   double gammaSimToolCentral;                 // gamma central from elegant (set energy)
+  ElementSampling gammaSampling;              // compact storage instead of gammaSimTool (config <compact>)
+  CompactSamples gammaCompact;
   LongitudinalPhaseSpaceModel syliModel;      // for gammaMode "radiation"
+  double gammaDeviation;                      // gamma-gamma0 of this particle (gammaMode "offset" & "oscillation")
+
+  // gammaMode "oscillation": synchrotron phase as phasor exp(i*phase),
+  // rotated element by element and recalculated exactly once per turn
+  double synchrotronWavenumber;                       // 2pi * synchrotron freq. / c (1/m)
+  std::vector<std::complex<double>> synchrotronStep;  // phasor rotation from each element to the next
+  std::complex<double> synchrotronPhasor;
+  bool synchrotronPhasorValid;
+
+  // resonance strengths from tracked fields (config spintracking <resonanceStrengths>)
+  ResonanceSumGrid resStrengthSums;
+  std::vector<double> elementTheta;           // theta at each element (dipoles: entrance)
+  std::vector<double> dipoleAngle;            // theta(exit)-theta(entrance) of dipoles, 0 otherwise
+  std::vector<std::complex<double>> resStrengths; // per turn, at agammaGrid()
+
+  double linearFieldDeviation;                // max. deviation of linearized fields (config <linearFields><check>)
+  std::string linearFieldDeviationElement;
   
   //variables for current tracking step
   pal::AccLattice::const_iterator currentElement; // position in lattice
+  unsigned int currentIndex;                      // index of currentElement in lattice
   double currentGamma;                            // gamma
 
   arma::running_stat<double> gammaStat;       // gamma statistics
@@ -78,43 +111,58 @@ private:
   void outfileOpen();                         // open output file and write header
   void outfileClose();                        // write footer and close output file
   void outfileAdd(const double &t, const arma::colvec3 &s);  // append s(t) to outfile
-  void storeStep(const double &pos, const arma::colvec3 &s); // append s(t) to storage and outfile
+  void storeStep(unsigned int step, const double &pos, const arma::colvec3 &s); // append s(t) to storage, histograms and outfile
   void outfileAdd_ps(const double &pos);                     // append long. phase space(t) to outfile_ps
 
   void checkLongStability() const;            // check if longitudinal motion is stable (gammaMode "radiation")
+  inline double rfMagnetFactor(const double &pos);
+  void checkLinearField(const pal::AccTriple &linear, const pal::AccPair &traj);
+  void initSynchrotronPhasor();               // set up phasor rotations (gammaMode "oscillation")
+  unsigned int elementIndex(const pal::AccLattice::const_iterator &element) const;
+  void initResStrengths();
+  inline void addResStrengths(const pal::AccTriple &Bint, const double &pos);
+  void finishResStrengths(double turns);
 
   
 public:
-  TrackingTask(unsigned int id, const std::shared_ptr<Configuration> c);
+  TrackingTask(unsigned int id, const std::shared_ptr<Configuration> c, std::shared_ptr<const ObservationPoints> o);
   TrackingTask(const TrackingTask& other) = delete;
   TrackingTask(TrackingTask&& other) = default;
   ~TrackingTask() {}
 
   void run();                                 //run tracking task
+  static bool usesSimToolGamma() {return true;}
+  static void simToolTurns(const Configuration& c, const pal::FunctionOfPos<pal::AccPair>& orbit, unsigned int &first, unsigned int &last)
+  {first = orbit.turn(c.pos_start()); last = orbit.turn(c.pos_stop());}
   void matrixTracking();
 
   // particle energy gamma(pos), implementation depends GammaMode
   double (TrackingTask::*gamma)(const double&);
   void initGamma();
-  void saveGammaSimTool();
   
   // gamma(pos) implementations:
   double gammaFromConfig(const double &pos) {return config->gamma(pos/GSL_CONST_MKSA_SPEED_OF_LIGHT);}
-  double gammaFromSimTool(const double &pos) {return gammaSimTool.interpPeriodic(pos-config->pos_start());}
+  double gammaFromSimTool(const double &pos);
   double gammaFromSimToolPlusConfig(const double &pos) {return gammaFromSimTool(pos) - gammaSimToolCentral + gammaFromConfig(pos); }
-  double gammaFromSimToolNoInterpolation(const double &pos) {return gammaSimTool.infrontof(pos-config->pos_start());}
+  double gammaFromSimToolNoInterpolation(const double &pos);
   double gammaRadiation(const double &pos);
-  double gammaOffset(const double &pos) {return gammaFromConfig(pos) + syliModel.gammaMinusGamma0();}
-  double gammaOscillation(const double &pos) {return gammaFromConfig(pos) + syliModel.gammaMinusGamma0()*cos(2*M_PI*syliModel.synchrotronFreq_current()*pos/GSL_CONST_MKSA_SPEED_OF_LIGHT + particleId);} // uses particleId for individual start phases
+  double gammaOffset(const double &pos) {return gammaFromConfig(pos) + gammaDeviation;}
+  double gammaOscillation(const double &pos);
 
   inline arma::mat33 rotxMatrix(double angle) const;
-  inline arma::mat33 rotMatrix(pal::AccTriple B) const;
+  static arma::mat33 rotMatrix(pal::AccTriple B);      // spin rotation by angle vector B (also used by SpinTuneSolver)
   
   std::string outfileName() const;            // output file name
   std::string phasespaceOutfileName() const; // phase space output file name
 
-  SpinMotion getStorage() const {return storage;}
-  double getProgress() const {return (double)storage.size() / config->outSteps();}
+  const SpinMotion& getStorage() const {return storage;}
+  const std::vector<SpinMotion>& getTransferStorage() const {return transferStorage;}
+  const std::vector<SpinMotion>& getOutputStorage() const {return outputStorage;}
+  const SpinSpectrum& getSpectrum() const {return spectrum;}
+  std::unique_ptr<SpinHistograms> takeHistograms() {return std::move(histograms);} // nullptr if taken before
+  void releaseStorage() {storage.clear();}    // free spins, after they are added to the polarization
+  const std::vector<std::complex<double>>& getResStrengths() const {return resStrengths;}
+  double getProgress() const {return (double)storage.size() / observation->schedule().steps();}
   bool isCompleted() const {return completed;}
   
 };
@@ -22,6 +22,7 @@
 #include <boost/random/uniform_real_distribution.hpp>
 #include <boost/random/mersenne_twister.hpp>
 #include "Trajectory.hpp"
+#include "StartDistribution.hpp"
 #include "debug.hpp"
 
 
@@ -35,39 +36,122 @@ void Trajectory::init()
 }
 
 
-SimtoolTrajectory::SimtoolTrajectory(unsigned int id, const std::shared_ptr<Configuration> c)
-  : Trajectory(id,c), simtoolTrajectory(config->getSimToolInstance(), gsl_interp_akima) {}
+void SimtoolTrajectory::initImplementation()
+{
+  if (!simToolStore)
+    throw std::runtime_error("SimtoolTrajectory: no SimToolStore set");
+  SimToolStore::TrajectorySamples t = simToolStore->takeTrajectory(particleId);
+  simtoolTrajectory = t.full;
+  compactX = std::move(t.x);
+  compactZ = std::move(t.z);
+  if (!compactX.empty())
+    sampling = simToolStore->sampling();
+}
 
 
-void SimtoolTrajectory::initImplementation()
+pal::AccPair SimtoolTrajectory::get(const double& pos)
 {
-  // simtool: sdds import thread safe since SDDSToolKit-devel-3.3.1-2
-  simtoolTrajectory.simToolTrajectory( config->getSimToolInstance(), particleId+1 );
+  if (compactX.empty())
+    return simtoolTrajectory->interpPeriodic(pos-config->pos_start());
+
+  double w;
+  std::size_t i = sampling.locate(pos, w);
+  pal::AccPair traj;
+  traj.x = compactX.interp(i, w);
+  traj.z = compactZ.interp(i, w);
+  return traj;
 }
 
 
-void SimtoolTrajectory::saveSimtoolData()
+const double elementTolerance = 1e-6;  // m, max. distance of a position from element to use precalculation
+
+OscillationTable::OscillationTable(const std::shared_ptr<Configuration> config, const pal::AccLattice &lattice,
+				   const pal::FunctionOfPos<pal::AccPair> &orbit)
+  : beta(config->getSimToolInstance())
 {
-  if ( !config->saveGamma(particleId) )
-    return;
-  
-  simtoolTrajectory.info.add("polematrix particle ID", particleId);
-  std::stringstream file;
-  file <<std::setw(4)<<std::setfill('0')<< particleId << ".dat";
-  simtoolTrajectory.print( (config->outpath()/"trajectorySimtool_").string() + file.str() );
+  // init twiss functions beta & phase
+  std::string betaX, betaZ;
+  if (config->getSimToolInstance().tool == pal::madx) {
+    betaX = "BETX";
+    betaZ = "BETY";
+  }
+  else if (config->getSimToolInstance().tool == pal::elegant) {
+    betaX = "betax";
+    betaZ = "betay";
+  }
+  beta.readTwissColumn(config->getSimToolInstance(), betaX, betaZ);
+  std::cout << "* " << beta.size() << " beta function sampling points read" << std::endl
+	    << "  from " << config->getSimToolInstance().twiss() << std::endl;
+
+  // init oscillation frequency from tune
+  freq = config->tune() * 2*M_PI / orbit.circumference();
+
+  elements.init(lattice, 1, 0);
+  unsigned int e = 0;
+  for (auto it=lattice.begin(); it!=lattice.end(); ++it, e++) {
+    pal::AccPair b = beta.interp(it.pos());
+    pal::AccPair a;
+    a.x = std::sqrt(b.x);
+    a.z = std::sqrt(b.z);
+    sqrtBeta.push_back(a);
+    orbitAt.push_back( orbit.interp(it.pos()) );
+    stepX.push_back( std::polar(1., freq.x * elements.distanceNext(e)) );
+    stepZ.push_back( std::polar(1., freq.z * elements.distanceNext(e)) );
+  }
 }
 
 
 Oscillation::Oscillation(unsigned int id, const std::shared_ptr<Configuration> c)
-  : Trajectory(id,c), beta(config->getSimToolInstance()) {}
+  : Trajectory(id,c), phasorTurn(0), phasorElement(0), phasorValid(false) {}
+
 
 pal::AccPair Oscillation::get(const double& pos)
+{
+  long turn;
+  double distance;
+  unsigned int e = elements.element(pos, turn, distance, elementTolerance);
+  if (std::fabs(distance) > elementTolerance)
+    return calculate(pos);
+
+  advancePhasor(turn, e);
+  const OscillationTable &table = *oscillationTable;
+  pal::AccPair traj;
+  traj.x = sqrtEmittance.x * table.sqrtBeta[e].x * phasorX.real();
+  traj.z = sqrtEmittance.z * table.sqrtBeta[e].z * phasorZ.real();
+  return table.orbitAt[e] + traj;
+}
+
+
+// rotate phasor to following element or calculate it exactly (first element of turn or backward access)
+void Oscillation::advancePhasor(long turn, unsigned int element)
+{
+  if (phasorValid && turn == phasorTurn && element == phasorElement)
+    return;
+
+  if (phasorValid && element != 0 && turn == phasorTurn && element > phasorElement) {
+    for (unsigned int e=phasorElement; e<element; e++) {
+      phasorX *= oscillationTable->stepX[e];
+      phasorZ *= oscillationTable->stepZ[e];
+    }
+  }
+  else {
+    double pos = elements.pos(turn, element);
+    phasorX = std::polar(1., oscillationTable->freq.x * pos + phase0.x);
+    phasorZ = std::polar(1., oscillationTable->freq.z * pos + phase0.z);
+  }
+  phasorTurn = turn;
+  phasorElement = element;
+  phasorValid = true;
+}
+
+
+pal::AccPair Oscillation::calculate(const double& pos)
 {
   double s = orbit->posInTurn(pos);
   // oscillation amplitude from (single particle) emittance & beta function
   // oscillation frequency from tune (see initImplementation())
-  pal::AccPair b = beta.interp(s);
-  pal::AccPair phase = freq * pos + phase0;
+  pal::AccPair b = oscillationTable->beta.interp(s);
+  pal::AccPair phase = oscillationTable->freq * pos + phase0;
   pal::AccPair traj;
   traj.x = std::sqrt(emittance.x * b.x) * std::cos(phase.x);
   traj.z = std::sqrt(emittance.z * b.z) * std::cos(phase.z);
@@ -75,36 +159,38 @@ pal::AccPair Oscillation::get(const double& pos)
 }
 
 
+// element table is shared by all particles. without model (no table set) it is built for this particle
 void Oscillation::initImplementation()
 {
-  // init twiss functions beta & phase
-  std::string betaX, betaZ;
-  if (config->getSimToolInstance().tool == pal::madx) {
-    betaX = "BETX";
-    betaZ = "BETY";
-  }
-  else if (config->getSimToolInstance().tool == pal::elegant) {
-    betaX = "betax";
-    betaZ = "betay";
-  }
-  beta.readTwissColumn(config->getSimToolInstance(), betaX, betaZ);
-  if (particleId == 0) {
-  std::cout << "* " << beta.size() << " beta function sampling points read" << std::endl
-	    << "  from " << config->getSimToolInstance().twiss() << std::endl;
+  if (!oscillationTable) {
+    if (!lattice || !orbit)
+      throw std::runtime_error("Oscillation: no lattice and orbit set");
+    oscillationTable = std::make_shared<const OscillationTable>(config, *lattice, *orbit);
   }
+  elements = oscillationTable->elements;
 
   // init single particle emittance (gaussian distribution)
   //      & start phase (uniform distribution)
-  boost::random::normal_distribution<> exDistr(0.0, config->emittance().x);
-  boost::random::normal_distribution<> ezDistr(0.0, config->emittance().z);
-  boost::random::uniform_real_distribution<> phase0Distr(0.0, 2*M_PI);
-
-  boost::random::mt11213b rng(config->seed()+particleId);
-  emittance.x = std::fabs( exDistr(rng) );
-  emittance.z = std::fabs( ezDistr(rng) );
-  phase0.x = phase0Distr(rng);
-  phase0.z = phase0Distr(rng);
+  if (StartDistribution::used(*config)) {
+    StartDistribution start(*config, particleId, startSequence.get());
+    emittance.x = start.halfNormal(StartDistribution::emittanceX, config->emittance().x);
+    emittance.z = start.halfNormal(StartDistribution::emittanceZ, config->emittance().z);
+    phase0.x = start.uniform(StartDistribution::betatronPhaseX, 0.0, 2*M_PI);
+    phase0.z = start.uniform(StartDistribution::betatronPhaseZ, 0.0, 2*M_PI);
+  }
+  else {
+    boost::random::normal_distribution<> exDistr(0.0, config->emittance().x);
+    boost::random::normal_distribution<> ezDistr(0.0, config->emittance().z);
+    boost::random::uniform_real_distribution<> phase0Distr(0.0, 2*M_PI);
+
+    boost::random::mt11213b rng(config->seed()+particleId);
+    emittance.x = std::fabs( exDistr(rng) );
+    emittance.z = std::fabs( ezDistr(rng) );
+    phase0.x = phase0Distr(rng);
+    phase0.z = phase0Distr(rng);
+  }
 
-  // init oscillation frequency from tune
-  freq = config->tune() * 2*M_PI / orbit->circumference();
+  sqrtEmittance.x = std::sqrt(emittance.x);
+  sqrtEmittance.z = std::sqrt(emittance.z);
+  phasorValid = false;
 }
@@ -22,8 +22,15 @@
 #define __POLEMATRIX__TRAJECTORY_HPP_
 
 #include <memory>
+#include <vector>
+#include <complex>
 #include <libpalattice/FunctionOfPos.hpp>
 #include "Configuration.hpp"
+#include "SimToolStore.hpp"
+#include "CompactSamples.hpp"
+#include "StartDistribution.hpp"
+
+class OscillationTable;
 
 
 class Trajectory
@@ -34,6 +41,10 @@ public:
 
 protected:
   const std::shared_ptr<Configuration> config;
+  std::shared_ptr<SimToolStore> simToolStore;
+  std::shared_ptr<const pal::AccLattice> lattice;
+  std::shared_ptr<const StartSequence> startSequence;
+  std::shared_ptr<const OscillationTable> oscillationTable; // trajectoryMode oscillation only
   bool initDone;
 
 public:
@@ -41,11 +52,14 @@ public:
   virtual ~Trajectory() {}
 
   void setOrbit(std::shared_ptr<const pal::FunctionOfPos<pal::AccPair>> o) {orbit = o;}
+  void setSimToolStore(std::shared_ptr<SimToolStore> s) {simToolStore = s;}
+  void setLattice(std::shared_ptr<const pal::AccLattice> l) {lattice = l;}
+  void setStartSequence(std::shared_ptr<const StartSequence> q) {startSequence = q;}
+  void setOscillationTable(std::shared_ptr<const OscillationTable> t) {oscillationTable = t;}
   
   virtual pal::AccPair get(const double& pos) =0;
   
   void init();
-  virtual void saveSimtoolData() {}
   virtual void clear() {} // clear trajectory data
 
 protected:
@@ -70,27 +84,55 @@ protected:
 class SimtoolTrajectory : public Trajectory
 {
 private:
-  pal::FunctionOfPos<pal::AccPair> simtoolTrajectory;
-  
+  std::shared_ptr<SimToolStore::TrajectoryData> simtoolTrajectory; // taken from SimToolStore
+  ElementSampling sampling;          // compact storage instead (config <compact>): trajectory at all elements
+  CompactSamples compactX, compactZ;
+
+
 public:
-  SimtoolTrajectory(unsigned int id, const std::shared_ptr<Configuration> c);
+  SimtoolTrajectory(unsigned int id, const std::shared_ptr<Configuration> c) : Trajectory(id,c) {}
   virtual ~SimtoolTrajectory() {}
-  virtual pal::AccPair get(const double& pos) {return simtoolTrajectory.interpPeriodic(pos-config->pos_start());}
-  virtual void clear() {simtoolTrajectory.clear();}
-  virtual void saveSimtoolData();
+  virtual pal::AccPair get(const double& pos);
+  virtual void clear() {simtoolTrajectory.reset(); compactX.clear(); compactZ.clear();}
 
   protected:
   virtual void initImplementation();
 };
 
 
+// oscillation model data equal for all particles, built once per model (Simulation::setModel):
+// precalculated at each lattice element, scaled by emittance & phase of each particle
+class OscillationTable
+{
+public:
+  pal::FunctionOfPos<pal::AccPair> beta;          // beta function (twiss)
+  pal::AccPair freq;                              // oscillation frequency / 1/m
+  ElementSampling elements;                       // copy it, its cursor is not thread safe
+  std::vector<pal::AccPair> sqrtBeta;             // sqrt(beta)
+  std::vector<pal::AccPair> orbitAt;              // closed orbit
+  std::vector<std::complex<double>> stepX, stepZ; // phase advance to next element
+
+  OscillationTable(const std::shared_ptr<Configuration> config, const pal::AccLattice &lattice,
+		   const pal::FunctionOfPos<pal::AccPair> &orbit);
+};
+
+
 class Oscillation : public Trajectory
 {
 private:
-  pal::FunctionOfPos<pal::AccPair> beta;  // beta function (twiss)
-  AccPair emittance;                      // single particle emittance
-  AccPair phase0;                         // phase(0) start value
-  AccPair freq;                           // oscillation frequency / 1/m
+  pal::AccPair emittance;                 // single particle emittance
+  pal::AccPair sqrtEmittance;
+  pal::AccPair phase0;                    // phase(0) start value
+
+  // phase advanced element by element by complex rotation, recalculated exactly once per turn
+  ElementSampling elements;
+  std::complex<double> phasorX, phasorZ;          // exp(i*phase) at phasorElement
+  long phasorTurn;
+  unsigned int phasorElement;
+  bool phasorValid;
+
+  pal::AccPair calculate(const double& pos);       // at any position (no precalculation)
+  void advancePhasor(long turn, unsigned int element);
   
 public:
   Oscillation(unsigned int id, const std::shared_ptr<Configuration> c);
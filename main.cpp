@@ -23,6 +23,8 @@
 #include <libpalattice/FunctionOfPos.hpp>
 #include "Tracking.hpp"
 #include "ResStrengths.hpp"
+#include "SpinTuneSolver.hpp"
+#include "Depolarization.hpp"
 #include "version.hpp"
 
 namespace po = boost::program_options;
@@ -54,6 +56,8 @@ int main(int argc, char *argv[])
     ("version,V", "display version")
     ("template,T", "create config file template (template.pole) and quit")
     ("resonance-strengths,R", "estimate strengths of depolarizing resonances")
+    ("spin-axis,N", "calculate invariant spin axis n0 & spin tune from one-turn spin map on closed orbit")
+    ("depolarization,D", "estimate equilibrium polarization & depolarization time from linear spin-orbit coupling")
     ;
 
   po::options_description confs("Configuration Options");
@@ -63,7 +67,7 @@ int main(int argc, char *argv[])
     ("verbose,v", "more output, e.g. each written spin file")
     ("no-progressbar,n", "do not show progress bar during tracking")
     ("all,a", "write all output (e.g. lattice and orbit)")
-    ("spintune,s", po::value<double>(), "in resonance-strengths mode: calculate for given spin tune only")
+    ("spintune,s", po::value<double>(), "in resonance-strengths, spin-axis & depolarization mode: calculate for given spin tune only")
     ;
   
   po::options_description hidden("Hidden Options");
@@ -140,14 +144,23 @@ int main(int argc, char *argv[])
   // resonance strengths mode (no tracking)
   if (args.count("resonance-strengths")) {
     ResStrengths r(t.config, nThreads);
-    // initialize model from simtool
+    if (args.count("spintune")) {
+      t.config->set_agammaMin( args["spintune"].as<double>() );
+      t.config->set_agammaMax( args["spintune"].as<double>() );
+    }
+    // initialize model from simtool, if not all res. strengths are cached
     try {
-      r.setModel();
+      if (!r.loadCache() || args.count("all"))
+	r.setModel();
     }
     catch (pal::palatticeError &e) {
       std::cout << e.what() << std::endl << "Quit." << std::endl;
       return 3;
     }
+    catch (std::runtime_error &e) { // ResStrengthsCache
+      std::cout << e.what() << std::endl << "Quit." << std::endl;
+      return 3;
+    }
     if (args.count("all")) {
       r.saveLattice();
       r.saveOrbit();
@@ -170,6 +183,66 @@ int main(int argc, char *argv[])
 
 
   
+  // spin axis mode (no tracking)
+  if (args.count("spin-axis")) {
+    SpinTuneSolver n(t.config, nThreads);
+    if (args.count("spintune")) {
+      t.config->set_agammaMin( args["spintune"].as<double>() );
+      t.config->set_agammaMax( args["spintune"].as<double>() );
+    }
+    try {
+      n.setModel();
+    }
+    catch (pal::palatticeError &e) {
+      std::cout << e.what() << std::endl << "Quit." << std::endl;
+      return 3;
+    }
+    try{
+      n.start();
+      if (args.count("spintune"))
+	std::cout << n.print();
+      else
+	n.save();
+    }
+    catch (std::exception &e) {
+      std::cout << e.what() << std::endl << "Quit." << std::endl;
+      return 2;
+    }
+    return 0;
+  }
+
+
+  // depolarization estimate mode (no tracking)
+  if (args.count("depolarization")) {
+    DepolarizationEstimate d(t.config, nThreads);
+    if (args.count("spintune")) {
+      t.config->set_agammaMin( args["spintune"].as<double>() );
+      t.config->set_agammaMax( args["spintune"].as<double>() );
+    }
+    try {
+      d.setModel();
+    }
+    catch (pal::palatticeError &e) {
+      std::cout << e.what() << std::endl << "Quit." << std::endl;
+      return 3;
+    }
+    try{
+      d.start();
+      if (args.count("spintune")) {
+	std::cout << d.print();
+	d.saveCoupling();
+      }
+      else
+	d.save();
+    }
+    catch (std::exception &e) {
+      std::cout << e.what() << std::endl << "Quit." << std::endl;
+      return 2;
+    }
+    return 0;
+  }
+
+
   t.config->printSummary();
   
   // initialize model from simtool
@@ -180,6 +253,10 @@ int main(int argc, char *argv[])
     std::cout << e.what() << std::endl << "Quit." << std::endl;
     return 3;
   }
+  catch (std::runtime_error &e) { // SimToolStore <chunks>
+    std::cout << e.what() << std::endl << "Quit." << std::endl;
+    return 3;
+  }
 
   if (args.count("all")) {
     t.saveLattice();
@@ -197,6 +274,10 @@ int main(int argc, char *argv[])
   }
 
   t.savePolarization();
+  t.savePolarizationMatrix();
+  t.saveHistograms();
+  t.saveSpectrum();
+  t.saveResStrengths();
 
   return 0;
 }
@@ -0,0 +1,78 @@
+#include "gtest/gtest.h"
+#include "OutputSchedule.hpp"
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+
+static pal::AccPair tune(double x, double z)
+{
+  pal::AccPair Q;
+  Q.x = x;
+  Q.z = z;
+  return Q;
+}
+
+
+
+// integer and n+-Q resonances, covering the spin tune range by one integer on both sides.
+// integer tune (z) has no intrinsic resonances besides the integers
+TEST(Resonances, List) {
+  std::vector<double> r = OutputSchedule::resonances(1.2, 1.8, tune(3.3, 2.0));
+  std::vector<double> expected = {-0.3, 0., 0.3, 0.7, 1., 1.3, 1.7, 2., 2.3, 2.7, 3., 3.3};
+  ASSERT_EQ(expected.size(), r.size());
+  for (auto i=0u; i<r.size(); i++)
+    EXPECT_NEAR(expected[i], r[i], 1e-12);
+}
+
+
+// half-integer tunes: n+Q and (n+1)-Q coincide and are listed once
+TEST(Resonances, Unique) {
+  std::vector<double> r = OutputSchedule::resonances(0.2, 0.4, tune(4.5, 6.5));
+  std::vector<double> expected = {-1.5, -1., -0.5, 0., 0.5, 1., 1.5, 2., 2.5};
+  ASSERT_EQ(expected.size(), r.size());
+  for (auto i=0u; i<r.size(); i++)
+    EXPECT_DOUBLE_EQ(expected[i], r[i]);
+}
+
+
+// sorted, strictly increasing and beyond the range (energy ramp over several integers)
+TEST(Resonances, Sorted) {
+  const double min = 1.97, max = 5.43;
+  std::vector<double> r = OutputSchedule::resonances(min, max, tune(7.12, 5.21));
+  ASSERT_FALSE(r.empty());
+  for (auto i=1u; i<r.size(); i++)
+    EXPECT_LT(r[i-1], r[i]);
+  EXPECT_LE(r.front(), min-1.);
+  EXPECT_GE(r.back(), max+1.);
+  for (int n=1; n<=7; n++) {
+    for (double res : {n-0.12, n+0.12, n-0.21, n+0.21, double(n)})
+      EXPECT_TRUE(std::any_of(r.begin(), r.end(), [&](double x){return std::fabs(x-res) < 1e-9;})) << res;
+  }
+}
+
+
+// uniform output: all steps before t_stop, as reached by the tracking
+TEST(Schedule, UniformSteps) {
+  Configuration config;
+  config.set_t_start(0.2);
+  for (double dt : {1e-4, 3e-4, 2.5e-4}) {
+    for (double t_stop : {0.201, 0.20105, 0.2013}) {
+      config.set_t_stop(t_stop);
+      config.set_dt_out(dt);
+      OutputSchedule schedule;
+      schedule.init(config);
+      ASSERT_GT(schedule.steps(), 0u);
+      EXPECT_LT(schedule.time(schedule.steps()-1), t_stop);
+      EXPECT_GE(schedule.time(schedule.steps()), t_stop);
+    }
+  }
+}
+
+
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,116 @@
+#include "gtest/gtest.h"
+#include "ResonanceSums.hpp"
+
+#include <vector>
+#include <complex>
+#include <random>
+#include <cmath>
+
+
+// random field samples over 20 turns
+class Sums : public ::testing::Test {
+public:
+  ResonanceSum sum;
+  double l1;  // sum of absolute coefficients
+  
+  Sums() : l1(0.)
+  {
+    std::default_random_engine rng(4711);
+    std::uniform_real_distribution<double> theta(0.0, 20*2*M_PI);
+    std::uniform_real_distribution<double> c(-1.0, 1.0);
+    for (auto j=0u; j<2000; j++) {
+      double x = c(rng);
+      double s = c(rng);
+      sum.add(theta(rng), x, s);
+      l1 += std::max(std::fabs(x), std::fabs(s));
+    }
+  }
+};
+
+
+
+// geometric series vs. direct sum, also at & near integer spin tunes
+TEST(TurnSum, Direct) {
+  for (double agamma : {0., 1., 3., -2., 0.3, 2.5, 3.0000001, 2.9999999999, 7.77}) {
+    for (unsigned int n : {1u, 2u, 7u, 100u}) {
+      std::complex<double> direct(0,0);
+      for (auto t=0u; t<n; t++)
+	direct += std::polar(1., 2*M_PI*agamma*t);
+      std::complex<double> s = turnSum(agamma,n);
+      EXPECT_NEAR(direct.real(), s.real(), 1e-9*n);
+      EXPECT_NEAR(direct.imag(), s.imag(), 1e-9*n);
+    }
+  }
+}
+
+
+// grid evaluation (rotation of exponentials) vs. single evaluation
+TEST_F(Sums, Grid) {
+  std::vector<std::complex<double>> x, s;
+  sum.evaluate(0.5, 1e-3, 500, x, s);
+  for (auto k=0u; k<500; k+=7) {
+    std::complex<double> xk, sk;
+    sum.evaluate(0.5+k*1e-3, xk, sk);
+    EXPECT_NEAR(0., std::abs(xk-x[k]), 1e-12*l1);
+    EXPECT_NEAR(0., std::abs(sk-s[k]), 1e-12*l1);
+  }
+}
+
+
+// non-uniform FFT vs. grid evaluation for different tolerances
+TEST_F(Sums, Nufft) {
+  for (double tolerance : {1e-4, 1e-8, 1e-12}) {
+    for (unsigned int n : {1u, 301u, 1000u}) {
+      std::vector<std::complex<double>> x, s, X, S;
+      sum.evaluate(0.3, 0.0123, n, x, s);
+      sum.evaluateNufft(0.3, 0.0123, n, X, S, tolerance);
+      for (auto k=0u; k<n; k++) {
+	EXPECT_NEAR(0., std::abs(x[k]-X[k]), tolerance*l1);
+	EXPECT_NEAR(0., std::abs(s[k]-S[k]), tolerance*l1);
+      }
+    }
+  }
+}
+
+
+
+// streamed samples (several buffer flushes) vs. all samples at once
+TEST(ResonanceSumGrid, Stream) {
+  std::default_random_engine rng(815);
+  std::uniform_real_distribution<double> c(-1.0, 1.0);
+  ResonanceSum elements, dipoles;
+  ResonanceSumGrid stream;
+  stream.init(1.5, 0.01, 200);
+  double l1 = 0.;
+  for (auto j=0u; j<20000; j++) {
+    double theta = 0.01*j;
+    double x = c(rng);
+    double s = c(rng);
+    l1 += std::max(std::fabs(x), std::fabs(s));
+    if (j%3 == 0) {
+      dipoles.add(theta, x, s);
+      stream.addDipole(theta, x, s);
+    }
+    else {
+      elements.add(theta, x, s);
+      stream.addElement(theta, x, s);
+    }
+  }
+  stream.flush();
+
+  std::vector<std::complex<double>> Px, Ps, Qx, Qs;
+  elements.evaluate(1.5, 0.01, 200, Px, Ps);
+  dipoles.evaluate(1.5, 0.01, 200, Qx, Qs);
+  for (auto k=0u; k<200; k++) {
+    double agamma = 1.5+k*0.01;
+    std::complex<double> e = resonanceStrength(agamma, 0.00115965, true, Px[k], Ps[k], Qx[k], Qs[k]);
+    EXPECT_NEAR(0., std::abs(e-stream.epsilon(k, 0.00115965)), 1e-12*l1*(1+agamma));
+  }
+}
+
+
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
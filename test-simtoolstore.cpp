@@ -0,0 +1,123 @@
+#include "gtest/gtest.h"
+#include "SimToolStore.hpp"
+#include "SimToolCache.hpp"
+
+#include <fstream>
+#include <sstream>
+#include <set>
+
+
+// access to the SimTool runs prepared by the store
+class ChunkStore : public SimToolStore
+{
+public:
+  using SimToolStore::SimToolStore;
+  unsigned int numChunks() const {return chunks.size();}
+  unsigned int first(unsigned int i) const {return chunks.at(i).first;}
+  std::string latticeFile(unsigned int i) const {return chunks.at(i).sim->inFile();}
+  static int seed(int s, unsigned int i) {return chunkSeed(s,i);}
+};
+
+
+static void write(const fs::path &file, const std::string &content)
+{
+  fs::create_directories(file.parent_path());
+  std::ofstream out(file.string());
+  out << content;
+}
+
+static std::string read(const fs::path &file)
+{
+  std::ifstream in(file.string());
+  std::stringstream s;
+  s << in.rdbuf();
+  return s.str();
+}
+
+
+// lattice ring.lte includes sub/magnets.lte, which includes drifts.lte relative to itself
+class Chunks : public ::testing::Test
+{
+protected:
+  fs::path dir;
+
+  void SetUp() {
+    dir = fs::temp_directory_path() / fs::unique_path("polematrix-test-%%%%-%%%%");
+    write(dir/"ring.lte", "#include: sub/magnets.lte\nRING: LINE=(D1,Q1,D1)\n");
+    write(dir/"sub"/"magnets.lte", "Q1: QUAD, L=0.1, K1=1.2\n#include: \"drifts.lte\"\n");
+    write(dir/"sub"/"drifts.lte", "D1: DRIF, L=1.5\n");
+    write(dir/"config.pole",
+	  "<spintracking><t_stop>1e-5</t_stop><E0>1.32</E0><dE>0</dE>"
+	  "<s_start><x>0</x><z>1</z><s>0</s></s_start>"
+	  "<numParticles>4</numParticles><gammaModel>simtool</gammaModel><trajectoryModel>closed orbit</trajectoryModel></spintracking>"
+	  "<palattice><simTool>elegant</simTool><mode>online</mode><file>" + (dir/"ring.lte").string() + "</file>"
+	  "<chunks>2</chunks></palattice>"
+	  "<radiation><seed>7</seed></radiation>");
+  }
+  void TearDown() {
+    fs::remove_all(dir);
+  }
+};
+
+
+
+// two chunks of two particles, each with a self-contained copy of the lattice
+TEST_F(Chunks, IncludedLattice) {
+  auto config = std::make_shared<Configuration>((dir/"out").string());
+  config->load((dir/"config.pole").string());
+  ASSERT_EQ(2u, config->simToolChunks());
+
+  pal::AccLattice lattice(3.1);
+  ChunkStore store(config, lattice, 0, 0, 2);
+  ASSERT_EQ(2u, store.numChunks());
+  EXPECT_EQ(0u, store.first(0));
+  EXPECT_EQ(2u, store.first(1));
+
+  std::set<fs::path> files;
+  for (unsigned int i=0; i<store.numChunks(); i++) {
+    fs::path file = store.latticeFile(i);
+    files.insert(file);
+    EXPECT_EQ(dir/"out"/("simtool_chunk_"+std::to_string(i))/"ring.lte", file);
+    std::string content = read(file);
+    EXPECT_EQ(std::string::npos, content.find("#include"));
+    EXPECT_NE(std::string::npos, content.find("Q1: QUAD"));
+    EXPECT_NE(std::string::npos, content.find("D1: DRIF"));
+    EXPECT_LT(content.find("D1: DRIF"), content.find("RING: LINE"));
+  }
+  EXPECT_EQ(2u, files.size());
+  EXPECT_NE(ChunkStore::seed(config->seed(),0), ChunkStore::seed(config->seed(),1));
+}
+
+
+// user lattice is not modified
+TEST_F(Chunks, LatticeUnchanged) {
+  auto config = std::make_shared<Configuration>((dir/"out").string());
+  config->load((dir/"config.pole").string());
+  pal::AccLattice lattice(3.1);
+  ChunkStore store(config, lattice, 0, 0, 2);
+  EXPECT_EQ("#include: sub/magnets.lte\nRING: LINE=(D1,Q1,D1)\n", read(dir/"ring.lte"));
+}
+
+
+TEST_F(Chunks, MissingInclude) {
+  fs::remove(dir/"sub"/"drifts.lte");
+  EXPECT_THROW(resolvedLattice(dir/"ring.lte"), std::runtime_error);
+}
+
+
+// elegant accepts positive seeds only
+TEST(ChunkSeed, Positive) {
+  for (int seed : {0, 1, 7, -1, -2147483647, 2147483647}) {
+    for (unsigned int i=0; i<4; i++) {
+      EXPECT_GT(ChunkStore::seed(seed,i), 0);
+      EXPECT_NE(ChunkStore::seed(seed,i), ChunkStore::seed(seed,i+1));
+    }
+  }
+}
+
+
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
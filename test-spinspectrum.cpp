@@ -0,0 +1,66 @@
+#include "gtest/gtest.h"
+#include "SpinSpectrum.hpp"
+
+#include <vector>
+#include <cmath>
+
+
+// spin precessing around the vertical axis with fractional tune nu per turn.
+// positive guide field rotates x towards s (see TrackingTask::rotMatrix)
+static SpinSpectrum precession(double nu, double guideField, unsigned int turns, unsigned int every=1)
+{
+  SpinSpectrum spectrum(256, every, 256);
+  double orientation = (guideField < 0.) ? -1. : 1.;
+  for (auto n=1u; n<=turns; n++) {
+    double phase = 2*M_PI*nu*n;
+    arma::colvec3 s = {std::cos(phase), orientation*std::sin(phase), 0.};
+    spectrum.addTurn(n*1e-6, s, guideField);
+  }
+  return spectrum;
+}
+
+
+
+// peak at fractional spin tune, also between bins
+TEST(SpinSpectrum, Peak) {
+  for (double nu : {0.1, 0.3721, 0.5, 0.87}) {
+    SpinSpectrum spectrum = precession(nu, 1., 512);
+    ASSERT_EQ(2u, spectrum.get().size());
+    for (auto &window : spectrum.get())
+      EXPECT_NEAR(nu, SpinSpectrum::peak(window.second), 0.5/256);
+  }
+}
+
+
+// same spin tune for both field polarities
+TEST(SpinSpectrum, Orientation) {
+  for (double nu : {0.1, 0.3721}) {
+    SpinSpectrum spectrum = precession(nu, -3.5, 256);
+    ASSERT_EQ(1u, spectrum.get().size());
+    EXPECT_NEAR(nu, SpinSpectrum::peak(spectrum.get().begin()->second), 0.5/256);
+  }
+}
+
+
+// one sample every 2 turns: peak at 2*nu (modulo 1)
+TEST(SpinSpectrum, Sampling) {
+  SpinSpectrum spectrum = precession(0.3721, 1., 512, 2);
+  ASSERT_EQ(1u, spectrum.get().size());
+  EXPECT_NEAR(0.7442, SpinSpectrum::peak(spectrum.get().begin()->second), 0.5/256);
+}
+
+
+// bin frequency: power normalized to 1
+TEST(SpinSpectrum, Power) {
+  SpinSpectrum spectrum = precession(64./256, 1., 256);
+  const std::vector<double> &power = spectrum.get().begin()->second;
+  EXPECT_NEAR(1., power[64], 1e-12);
+  EXPECT_NEAR(64./256, SpinSpectrum::peak(power), 1e-12);
+}
+
+
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,85 @@
+#include "gtest/gtest.h"
+#include "SpinTuneSolver.hpp"
+
+#include <cmath>
+
+
+// rotation around vertical axis z by angle (spin components x,s,z).
+// positive angle rotates x towards s, as TrackingTask::rotMatrix for positive vertical field
+static arma::mat33 rotZ(double angle)
+{
+  arma::mat33 R;
+  R.eye();
+  R(0,0) = R(1,1) = std::cos(angle);
+  R(1,0) = std::sin(angle);
+  R(0,1) = -std::sin(angle);
+  return R;
+}
+
+// rotation around longitudinal axis s: tilts z towards -s
+static arma::mat33 rotS(double angle)
+{
+  arma::mat33 R;
+  R.eye();
+  R(1,1) = R(2,2) = std::cos(angle);
+  R(2,1) = std::sin(angle);
+  R(1,2) = -std::sin(angle);
+  return R;
+}
+
+// one-turn map of a flat ring: product of n equal vertical field rotations, total angle 2pi*agamma
+static arma::mat33 flatRing(double agamma, unsigned int n, double polarity=1.)
+{
+  arma::mat33 M;
+  M.eye();
+  for (auto i=0u; i<n; i++)
+    M = rotZ(polarity * 2*M_PI*agamma/n) * M;
+  return M;
+}
+
+
+
+// flat ring: spin tune = agamma modulo 1, n0 vertical
+TEST(InvariantAxis, FlatRing) {
+  for (double agamma : {0.37, 1.5, 2.37, 3.91}) {
+    arma::colvec3 n;
+    double tune;
+    SpinTuneTask::invariantAxis(flatRing(agamma, 16), arma::colvec3({0.,0.,1.}), n, tune);
+    EXPECT_NEAR(agamma - std::floor(agamma), tune, 1e-12);
+    EXPECT_NEAR(0., n(0), 1e-12);
+    EXPECT_NEAR(0., n(1), 1e-12);
+    EXPECT_NEAR(1., n(2), 1e-12);
+  }
+}
+
+
+// reversed field: same spin tune, n0 parallel to field
+TEST(InvariantAxis, Polarity) {
+  arma::colvec3 n;
+  double tune;
+  SpinTuneTask::invariantAxis(flatRing(2.37, 16, -1.), arma::colvec3({0.,0.,-1.}), n, tune);
+  EXPECT_NEAR(0.37, tune, 1e-12);
+  EXPECT_NEAR(-1., n(2), 1e-12);
+}
+
+
+// rotation around a tilted axis: n0 is the tilted axis, tune unchanged
+TEST(InvariantAxis, Tilted) {
+  const double tilt = 0.3;
+  arma::mat33 T = rotS(tilt);
+  arma::mat33 M = T * flatRing(2.37, 16) * T.t();
+  arma::colvec3 n;
+  double tune;
+  SpinTuneTask::invariantAxis(M, arma::colvec3({0.,0.,1.}), n, tune);
+  EXPECT_NEAR(0.37, tune, 1e-12);
+  EXPECT_NEAR(0., n(0), 1e-12);
+  EXPECT_NEAR(-std::sin(tilt), n(1), 1e-12);
+  EXPECT_NEAR(std::cos(tilt), n(2), 1e-12);
+}
+
+
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
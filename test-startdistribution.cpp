@@ -0,0 +1,100 @@
+#include "gtest/gtest.h"
+#include "StartDistribution.hpp"
+
+#include <cmath>
+#include <set>
+#include <vector>
+
+
+// mean of uniform value of dimension d over the first n particles
+static double uniformMean(const Configuration &c, const StartSequence &q, StartDistribution::Dimension d, unsigned int n)
+{
+  double sum = 0.;
+  for (auto i=0u; i<n; i++)
+    sum += StartDistribution(c, i, &q).uniform(d, 0., 1.);
+  return sum / n;
+}
+
+
+
+TEST(StartDistribution, Antithetic) {
+  Configuration c;
+  c.set_seed(47891);
+  c.set_antithetic(true);
+  for (auto sampling : {Sampling::random, Sampling::halton, Sampling::sobol}) {
+    c.set_sampling(sampling);
+    for (auto k=0u; k<10; k++) {
+      StartDistribution a(c, 2*k), b(c, 2*k+1);
+      EXPECT_NEAR(a.normal(StartDistribution::energy, 1., 0.1) + b.normal(StartDistribution::energy, 1., 0.1), 2., 1e-9);
+      double dphase = b.uniform(StartDistribution::betatronPhaseX, 0., 1.) - a.uniform(StartDistribution::betatronPhaseX, 0., 1.);
+      EXPECT_NEAR(std::fabs(dphase), 0.5, 1e-9);
+    }
+  }
+}
+
+
+// points of the shared sequence equal the points generated by each particle itself
+TEST(StartSequence, SameAsGenerated) {
+  Configuration c;
+  c.set_nParticles(20);
+  for (auto sampling : {Sampling::halton, Sampling::sobol}) {
+    c.set_sampling(sampling);
+    StartSequence q(c);
+    ASSERT_EQ(20u, q.size());
+    for (auto i=0u; i<c.nParticles(); i++) {
+      StartDistribution a(c, i), b(c, i, &q);
+      for (auto d=0u; d<StartDistribution::numDimensions; d++)
+	EXPECT_DOUBLE_EQ(a.uniform(StartDistribution::Dimension(d), 0., 1.), b.uniform(StartDistribution::Dimension(d), 0., 1.));
+    }
+  }
+}
+
+
+// quasi-random points are distinct in each dimension and inside (0,1)
+TEST(StartSequence, Distinct) {
+  Configuration c;
+  c.set_nParticles(1000);
+  for (auto sampling : {Sampling::halton, Sampling::sobol}) {
+    c.set_sampling(sampling);
+    StartSequence q(c);
+    for (auto d=0u; d<StartDistribution::numDimensions; d++) {
+      std::set<double> values;
+      for (auto i=0u; i<q.size(); i++) {
+	double u = q.point(i)[d];
+	EXPECT_GT(u, 0.);
+	EXPECT_LT(u, 1.);
+	values.insert(u);
+      }
+      EXPECT_EQ(q.size(), values.size()) << "dimension " << d;
+    }
+  }
+}
+
+
+// low discrepancy: error of the sample mean decreases like 1/n instead of 1/sqrt(n) for random sampling
+TEST(StartSequence, MeanConvergence) {
+  Configuration c;
+  c.set_nParticles(4096);
+  for (auto sampling : {Sampling::halton, Sampling::sobol}) {
+    c.set_sampling(sampling);
+    StartSequence q(c);
+    for (auto d=0u; d<StartDistribution::numDimensions; d++) {
+      auto dim = StartDistribution::Dimension(d);
+      for (unsigned int n : {256u, 1024u, 4096u})
+	EXPECT_LT(std::fabs(uniformMean(c, q, dim, n) - 0.5), 5./n) << "dimension " << d << ", " << n << " particles";
+    }
+
+    double sum = 0.;
+    for (auto i=0u; i<c.nParticles(); i++)
+      sum += StartDistribution(c, i, &q).normal(StartDistribution::energy, 1., 0.1);
+    EXPECT_NEAR(1., sum/c.nParticles(), 0.5*0.1/std::sqrt(c.nParticles()));
+  }
+}
+
+
+
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}